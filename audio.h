@@ -1,6 +1,7 @@
 #ifndef AUDIO
 #define AUDIO
 
+#include "mem.h"
 #include "utils.h"
 
 #define DR_WAV_IMPLEMENTATION
@@ -8,27 +9,68 @@
 
 #include <jack/jack.h>
 
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
 #include <fftw3.h>
 
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
 //-------------------------------------
 // audio
 //-------------------------------------
+// buf_in/buf_out hold one planar buffer per channel. the sample_t helpers
+// (audio_in, audio_out, ...) and graph io nodes work on a stereo bus: a pair
+// of neighbouring channels picked with audio_bus_in/audio_bus_out, which go
+// back to the first pair at the start of every cycle
+#define AUDIO_MAX_CHANS 32
+
+#ifndef AUDIO_CHANS_IN
+#define AUDIO_CHANS_IN 2
+#endif
+#ifndef AUDIO_CHANS_OUT
+#define AUDIO_CHANS_OUT 2
+#endif
+
+// used by audio_init, can be changed before init()
+uint audio_chans_in = AUDIO_CHANS_IN, audio_chans_out = AUDIO_CHANS_OUT;
+
 struct {
   jack_client_t *client;
-  jack_port_t *port_in[2], *port_out[2];
-  const float *buf_in[2];
-  float *buf_out[2];
+  jack_port_t *port_in[AUDIO_MAX_CHANS], *port_out[AUDIO_MAX_CHANS];
+  const float *buf_in[AUDIO_MAX_CHANS];
+  float *buf_out[AUDIO_MAX_CHANS];
+  uint chans_in, chans_out;
+  uint bus_in[2], bus_out[2];
   double rate;
   int frames, pos;
+  uint time;
+  float *offline;
 } audio;
 int audio_init();
+int audio_init_chans(uint chans_in, uint chans_out);
+int audio_init_offline(double rate, int frames, uint chans_in, uint chans_out);
 int audio_cleanup();
 void audio_start();
 void audio_stop();
+void audio_run(int frames);
+int audio_render(const char *in, const char *out, float dur);
+int ctrl_drain(int pos, int frames);
+void load_update(double elapsed, int frames);
+#ifdef PROFILE
+void prof_period(int frames);
+#else
+#define prof_period(frames)
+#endif
 
 extern void audio_callback();
 
 static int jack_callback(jack_nframes_t frames, void *arg);
+static int jack_xrun(void *arg);
 static void jack_shutdown(void *arg) { audio_cleanup(); }
 
 #define audio_loop for (audio.pos = 0; audio.pos < audio.frames; ++audio.pos)
@@ -42,26 +84,98 @@ typedef struct {
 
 #define sample_loop for (uint c = 0; c < 2; ++c)
 
+// planar stereo blocks, as taken by the *_process functions
+#define block_in(b) ((const float **)(b))
+
+// stereo pairs within the channels, for audio.bus_in / audio.bus_out
+#define bus_in(c) audio.buf_in[audio.bus_in[c]]
+#define bus_out(c) audio.buf_out[audio.bus_out[c]]
+
 //-------------------------------------
 // audio
+//-------------------------------------
+void audio_bus_in(uint chan) {
+  sample_loop audio.bus_in[c] = MIN(chan + c, audio.chans_in - 1);
+}
+
+//-------------------------------------
+void audio_bus_out(uint chan) {
+  sample_loop audio.bus_out[c] = MIN(chan + c, audio.chans_out - 1);
+}
+
+//-------------------------------------
+void audio_chans(uint chans_in, uint chans_out) {
+  audio.chans_in = CLIP(chans_in, 1, AUDIO_MAX_CHANS);
+  audio.chans_out = CLIP(chans_out, 1, AUDIO_MAX_CHANS);
+  audio_bus_in(0), audio_bus_out(0);
+}
+
+//-------------------------------------
+// the cycle is split wherever a ctrl message is due, so each one lands on
+// its own frame. audio_callback sees every piece as a block of its own
+void audio_run(int frames) {
+  double start = time_now();
+  const float *buf_in[AUDIO_MAX_CHANS];
+  float *buf_out[AUDIO_MAX_CHANS];
+
+  loop(c, audio.chans_out) memset(audio.buf_out[c], 0, frames * sizeof(float));
+  memcpy(buf_in, audio.buf_in, sizeof(buf_in));
+  memcpy(buf_out, audio.buf_out, sizeof(buf_out));
+
+  for (int pos = 0, next; pos < frames; pos = next) {
+    next = ctrl_drain(pos, frames);
+
+    loop(c, audio.chans_in) audio.buf_in[c] = buf_in[c] + pos;
+    loop(c, audio.chans_out) audio.buf_out[c] = buf_out[c] + pos;
+    audio_bus_in(0), audio_bus_out(0);
+
+    audio.frames = next - pos;
+    audio_callback();
+  }
+
+  memcpy(audio.buf_in, buf_in, sizeof(buf_in));
+  memcpy(audio.buf_out, buf_out, sizeof(buf_out));
+  audio.frames = frames;
+
+  load_update(time_now() - start, frames);
+  prof_period(frames);
+}
+
 //-------------------------------------
 static int jack_callback(jack_nframes_t frames, void *arg) {
-  static uint c = 0;
-  for (c = 0; c < 2; ++c) {
+  audio.time = jack_last_frame_time(audio.client);
+  loop(c, audio.chans_in) {
     audio.buf_in[c] = jack_port_get_buffer(audio.port_in[c], frames);
+  }
+  loop(c, audio.chans_out) {
     audio.buf_out[c] = jack_port_get_buffer(audio.port_out[c], frames);
-    memset(audio.buf_out[c], 0, frames * sizeof(float));
   }
 
-  audio.frames = frames;
-  audio_callback();
+  audio_run(frames);
 
   return 0;
 }
 
 //-------------------------------------
-int audio_init() {
+jack_port_t *audio_port(uint chan, uint chans, bool input) {
+  char name[32];
+  if (chans == 2)
+    snprintf(name, 32, "%s_%s", input ? "in" : "out", chan ? "right" : "left");
+  else
+    snprintf(name, 32, "%s_%i", input ? "in" : "out", chan + 1);
+
+  return jack_port_register(audio.client, name, JACK_DEFAULT_AUDIO_TYPE,
+                            input ? JackPortIsInput : JackPortIsOutput, 0);
+}
+
+//-------------------------------------
+int audio_init() { return audio_init_chans(audio_chans_in, audio_chans_out); }
+
+//-------------------------------------
+int audio_init_chans(uint chans_in, uint chans_out) {
   memset(&audio, 0, sizeof(audio));
+  mem_init(MEM_SIZE);
+  audio_chans(chans_in, chans_out);
 
   const char *client_name = "compact";
   const char *server_name = NULL;
@@ -87,19 +201,19 @@ int audio_init() {
   }
 
   jack_set_process_callback(audio.client, jack_callback, 0);
+  jack_set_xrun_callback(audio.client, jack_xrun, 0);
 
   jack_on_shutdown(audio.client, jack_shutdown, 0);
 
-  for (int c = 0; c < 2; ++c) {
-    audio.port_in[c] =
-        jack_port_register(audio.client, c == 0 ? "in_left" : "in_right",
-                           JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-
-    audio.port_out[c] =
-        jack_port_register(audio.client, c == 0 ? "out_left" : "out_right",
-                           JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  loop(c, audio.chans_in) {
+    if (!(audio.port_in[c] = audio_port(c, audio.chans_in, true))) {
+      printf("no more JACK ports available\n");
+      return -1;
+    }
+  }
 
-    if (!audio.port_in[c] || !audio.port_out[c]) {
+  loop(c, audio.chans_out) {
+    if (!(audio.port_out[c] = audio_port(c, audio.chans_out, false))) {
       printf("no more JACK ports available\n");
       return -1;
     }
@@ -107,19 +221,22 @@ int audio_init() {
 
   audio.rate = (double)jack_get_sample_rate(audio.client);
 
-  printf("init audio jack: successful!\n");
+  printf("init audio jack: successful! %i in, %i out\n", audio.chans_in,
+         audio.chans_out);
   return 0;
 }
 
 //-------------------------------------
 int audio_cleanup() {
-  jack_client_close(audio.client);
+  if (audio.client)
+    jack_client_close(audio.client), audio.client = NULL;
+  FREE(audio.offline);
   return 0;
 }
 
 //-------------------------------------
 void audio_start() {
-  if (jack_activate(audio.client))
+  if (!audio.client || jack_activate(audio.client))
     return;
 
   const char **ports;
@@ -133,7 +250,7 @@ void audio_start() {
       return;
     }
 
-    for (int c = 0; c < 2; ++c)
+    for (int c = 0; c < audio.chans_in && ports[c]; ++c)
       if (jack_connect(audio.client, ports[c],
                        jack_port_name(audio.port_in[c])))
         printf("cannot connect input port %i\n", c);
@@ -150,7 +267,7 @@ void audio_start() {
       return;
     }
 
-    for (int c = 0; c < 2; ++c)
+    for (int c = 0; c < audio.chans_out && ports[c]; ++c)
       if (jack_connect(audio.client, jack_port_name(audio.port_out[c]),
                        ports[c]))
         printf("cannot connect output port %i\n", c);
@@ -161,12 +278,479 @@ void audio_start() {
 
 //-------------------------------------
 void audio_stop() {
-  for (int c = 0; c < 2; ++c) {
-    jack_port_disconnect(audio.client, audio.port_in[c]);
-    jack_port_disconnect(audio.client, audio.port_in[c]);
+  if (!audio.client)
+    return;
+
+  loop(c, audio.chans_in) jack_port_disconnect(audio.client, audio.port_in[c]);
+  loop(c, audio.chans_out) {
+    jack_port_disconnect(audio.client, audio.port_out[c]);
+  }
+}
+
+//-------------------------------------
+// offline
+//-------------------------------------
+// drives audio_callback without jack, as fast as possible. buf_in is filled
+// from a wav file (or silence) and buf_out is written to a float wav
+int audio_init_offline(double rate, int frames, uint chans_in,
+                       uint chans_out) {
+  memset(&audio, 0, sizeof(audio));
+  mem_init(MEM_SIZE);
+  audio_chans(chans_in, chans_out);
+
+  if (rate <= 0 || frames <= 0) {
+    printf("[audio error] invalid offline rate %f or block size %i\n", rate,
+           frames);
+    return -1;
+  }
+
+  audio.offline =
+      calloc((audio.chans_in + audio.chans_out) * frames, sizeof(float));
+  loop(c, audio.chans_in) audio.buf_in[c] = audio.offline + c * frames;
+  loop(c, audio.chans_out) {
+    audio.buf_out[c] = audio.offline + (audio.chans_in + c) * frames;
+  }
+
+  audio.rate = rate;
+  audio.frames = frames;
+
+  printf("init audio offline: %.0fhz, %i frames, %i in, %i out\n", rate,
+         frames, audio.chans_in, audio.chans_out);
+  return 0;
+}
+
+//-------------------------------------
+int audio_render(const char *in, const char *out, float dur) {
+  if (!audio.offline || !out) {
+    printf("[audio error] offline backend not initialised\n");
+    return -1;
+  }
+
+  int frames = audio.frames;
+  drwav src, dst;
+  uint chans = 0;
+
+  if (in) {
+    if (!drwav_init_file(&src, in, NULL)) {
+      printf("[audio error] unable to open %s\n", in);
+      return -1;
+    }
+
+    chans = src.channels;
+    if (src.sampleRate != (uint)audio.rate)
+      printf("[audio] %s is %uhz, rendering at %.0fhz\n", in, src.sampleRate,
+             audio.rate);
+    if (dur <= 0)
+      dur = src.totalPCMFrameCount / audio.rate;
+  }
+
+  if (dur <= 0) {
+    printf("[audio error] nothing to render, no duration or input given\n");
+    if (in)
+      drwav_uninit(&src);
+    return -1;
+  }
+
+  drwav_data_format format = {drwav_container_riff, DR_WAVE_FORMAT_IEEE_FLOAT,
+                              audio.chans_out, (uint)audio.rate, 32};
+  if (!drwav_init_file_write(&dst, out, &format, NULL)) {
+    printf("[audio error] unable to open %s for writing\n", out);
+    if (in)
+      drwav_uninit(&src);
+    return -1;
+  }
+
+  // mono (or narrower) inputs are spread over the remaining channels
+  float *io = calloc(frames * MAX(chans, audio.chans_out), sizeof(float));
+  float *buf_in = audio.offline;
+  uint64_t total = ceil(dur * audio.rate), done = 0;
+  double start = time_now();
+
+  while (done < total) {
+    int n = MIN(frames, total - done);
+
+    memset(buf_in, 0, audio.chans_in * frames * sizeof(float));
+    if (in) {
+      int got = drwav_read_pcm_frames_f32(&src, n, io);
+      loop(c, audio.chans_in) loop(i, got) {
+        buf_in[c * frames + i] = io[i * chans + MIN(c, chans - 1)];
+      }
+    }
+
+    audio.time = done;
+    audio_run(n);
+
+    loop(i, n) loop(c, audio.chans_out) {
+      io[i * audio.chans_out + c] = audio.buf_out[c][i];
+    }
+    drwav_write_pcm_frames(&dst, n, io);
+
+    done += n;
+  }
+
+  double elapsed = time_now() - start;
+  double secs = total / audio.rate;
+  printf("[audio] rendered %.2fs in %.3fs (%.1fx realtime) to %s\n", secs,
+         elapsed, secs / MAX(elapsed, 1e-9), out);
+
+  free(io);
+  drwav_uninit(&dst);
+  if (in)
+    drwav_uninit(&src);
+
+  return 0;
+}
+
+//-------------------------------------
+// ctrl
+//-------------------------------------
+// parameter changes from the gui and midi threads. each source has its own
+// single producer / single consumer ring, which the audio thread drains
+// between blocks, so units are never changed halfway through one. a message
+// is a function to run on the audio thread, the object it runs on, a small
+// copy of its arguments, and the frame it was sent on. messages run one
+// period after they were sent, on the same frame within the period, so they
+// keep their spacing instead of bunching up at the start of a cycle
+#define CTRL_QUEUE_SIZE 256
+#define CTRL_MSG_SIZE 48
+
+typedef void (*ctrl_fn)(void *X, const void *data);
+
+typedef struct {
+  ctrl_fn fn;
+  void *X;
+  uint time;
+  char data[CTRL_MSG_SIZE];
+} ctrl_msg_t;
+
+typedef struct {
+  ctrl_msg_t msg[CTRL_QUEUE_SIZE];
+  uint read, write, dropped;
+} ctrl_queue_t;
+
+enum { CTRL_GUI, CTRL_MIDI, CTRL_NUM_SOURCES };
+
+ctrl_queue_t ctrl[CTRL_NUM_SOURCES];
+
+// the queue the current thread sends to, the gui (main) thread by default
+__thread ctrl_queue_t *ctrl_source = &ctrl[CTRL_GUI];
+
+//-------------------------------------
+void ctrl_set_source(int source) { ctrl_source = &ctrl[source]; }
+
+//-------------------------------------
+// the frame being played right now, in jack's frame time (or the current
+// cycle when offline). it wraps around, so only compare differences
+uint audio_frame_time() {
+  if (audio.client)
+    return jack_frame_time(audio.client);
+  return __atomic_load_n(&audio.time, __ATOMIC_RELAXED);
+}
+
+//-------------------------------------
+// time is a frame from audio_frame_time, now or later. messages from one
+// source have to be sent in order
+bool ctrl_send_at(ctrl_fn fn, void *X, const void *data, size_t size,
+                  uint time) {
+  ctrl_queue_t *Q = ctrl_source;
+  uint write = Q->write;
+
+  if (size > CTRL_MSG_SIZE ||
+      write - __atomic_load_n(&Q->read, __ATOMIC_ACQUIRE) >= CTRL_QUEUE_SIZE) {
+    Q->dropped++;
+    return false;
+  }
+
+  ctrl_msg_t *M = &Q->msg[write % CTRL_QUEUE_SIZE];
+  M->fn = fn, M->X = X, M->time = time;
+  memcpy(M->data, data, size);
+
+  __atomic_store_n(&Q->write, write + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+//-------------------------------------
+bool ctrl_send(ctrl_fn fn, void *X, const void *data, size_t size) {
+  return ctrl_send_at(fn, X, data, size, audio_frame_time());
+}
+
+//-------------------------------------
+// runs every message due at or before frame pos of this cycle, and returns
+// the frame the next one is due on (or frames, if none are due this cycle)
+int ctrl_drain(int pos, int frames) {
+  int next = frames;
+
+  loop(q, CTRL_NUM_SOURCES) {
+    ctrl_queue_t *Q = &ctrl[q];
+    uint read = Q->read, write = __atomic_load_n(&Q->write, __ATOMIC_ACQUIRE);
+
+    for (; read != write; ++read) {
+      ctrl_msg_t *M = &Q->msg[read % CTRL_QUEUE_SIZE];
+      int due = (int)(M->time + frames - audio.time);
+      if (due > pos) {
+        next = MIN(next, due);
+        break;
+      }
+      M->fn(M->X, M->data);
+    }
+
+    __atomic_store_n(&Q->read, read, __ATOMIC_RELEASE);
+  }
+
+  return next;
+}
+
+//-------------------------------------
+void ctrl_apply_float(void *X, const void *data) {
+  *(float *)X = *(const float *)data;
+}
+void ctrl_apply_int(void *X, const void *data) {
+  *(int *)X = *(const int *)data;
+}
+
+void ctrl_float(float *dst, float value) {
+  ctrl_send(ctrl_apply_float, dst, &value, sizeof(value));
+}
+void ctrl_int(int *dst, int value) {
+  ctrl_send(ctrl_apply_int, dst, &value, sizeof(value));
+}
+
+//-------------------------------------
+// load
+//-------------------------------------
+// how long each cycle takes against its period (frames / rate). the audio
+// thread is the only writer; every count is a single atomic word, so any
+// thread can read them at any time. the histogram has a bin per percent of
+// the period, the last bin holds everything over
+#define LOAD_BINS 201
+
+typedef struct {
+  double min, mean, p99, max; // fraction of the period
+  double period, cpu;         // period in ms, jack's own dsp load in percent
+  uint64_t cycles, xruns;
+} load_stats_t;
+
+struct {
+  uint64_t hist[LOAD_BINS];
+  uint64_t cycles, xruns, sum_ns, min_ns, max_ns, period_ns;
+  bool reset;
+} load;
+
+//-------------------------------------
+static int jack_xrun(void *arg) {
+  __atomic_fetch_add(&load.xruns, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+//-------------------------------------
+// called by audio_run after every cycle
+void load_update(double elapsed, int frames) {
+  if (__atomic_load_n(&load.reset, __ATOMIC_ACQUIRE)) {
+    loop(b, LOAD_BINS) __atomic_store_n(&load.hist[b], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&load.cycles, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&load.sum_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&load.max_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&load.reset, false, __ATOMIC_RELEASE);
+  }
+
+  uint64_t ns = elapsed * 1e9, period = frames / audio.rate * 1e9;
+  if (period == 0)
+    return;
+
+  if (load.cycles == 0 || ns < load.min_ns)
+    __atomic_store_n(&load.min_ns, ns, __ATOMIC_RELAXED);
+  if (ns > load.max_ns)
+    __atomic_store_n(&load.max_ns, ns, __ATOMIC_RELAXED);
+
+  int bin = MIN(ns * 100 / period, LOAD_BINS - 1);
+  __atomic_fetch_add(&load.hist[bin], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&load.sum_ns, ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&load.period_ns, period, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&load.cycles, 1, __ATOMIC_RELEASE);
+}
+
+//-------------------------------------
+// clears everything but the xrun count, on the next cycle
+void load_reset() { __atomic_store_n(&load.reset, true, __ATOMIC_RELEASE); }
+
+//-------------------------------------
+load_stats_t load_stats() {
+  load_stats_t S = {0};
+  uint64_t hist[LOAD_BINS];
+
+  S.cycles = __atomic_load_n(&load.cycles, __ATOMIC_ACQUIRE);
+  S.xruns = __atomic_load_n(&load.xruns, __ATOMIC_RELAXED);
+  if (audio.client)
+    S.cpu = jack_cpu_load(audio.client);
+
+  double period = __atomic_load_n(&load.period_ns, __ATOMIC_RELAXED);
+  if (S.cycles == 0 || period == 0)
+    return S;
+
+  S.period = period * 1e-6;
+  S.min = __atomic_load_n(&load.min_ns, __ATOMIC_RELAXED) / period;
+  S.max = __atomic_load_n(&load.max_ns, __ATOMIC_RELAXED) / period;
+  S.mean = __atomic_load_n(&load.sum_ns, __ATOMIC_RELAXED) / period / S.cycles;
+
+  // the bins can be a cycle or two ahead of the count, so go by their sum
+  uint64_t total = 0, count = 0;
+  loop(b, LOAD_BINS) total += hist[b] =
+      __atomic_load_n(&load.hist[b], __ATOMIC_RELAXED);
+
+  loop(b, LOAD_BINS) {
+    count += hist[b];
+    if (count * 100 >= total * 99) {
+      S.p99 = MIN((b + 1) * 0.01, S.max);
+      break;
+    }
+  }
+
+  return S;
+}
+
+//-------------------------------------
+void load_print() {
+  load_stats_t S = load_stats();
+  printf("[load] %lu cycles of %.2fms: min %.1f%%, mean %.1f%%, p99 %.1f%%, "
+         "max %.1f%%, jack %.1f%%, %lu xruns\n",
+         S.cycles, S.period, S.min * 100, S.mean * 100, S.p99 * 100,
+         S.max * 100, S.cpu, S.xruns);
+}
+
+//-------------------------------------
+// the summary and every non-empty bin of the histogram, for a log file
+int load_dump(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    printf("[load error] unable to open %s\n", path);
+    return -1;
+  }
+
+  load_stats_t S = load_stats();
+  fprintf(f, "cycles %lu\nxruns %lu\nperiod_ms %.3f\n", S.cycles, S.xruns,
+          S.period);
+  fprintf(f, "min %.4f\nmean %.4f\np99 %.4f\nmax %.4f\n", S.min, S.mean,
+          S.p99, S.max);
+  fprintf(f, "cpu %.4f\n", S.cpu);
+  fprintf(f, "# percent of period, cycles\n");
+  loop(b, LOAD_BINS) {
+    uint64_t n = __atomic_load_n(&load.hist[b], __ATOMIC_RELAXED);
+    if (n)
+      fprintf(f, "%s%i %lu\n", b == LOAD_BINS - 1 ? ">=" : "", b, n);
+  }
+
+  fclose(f);
+  return 0;
+}
+
+//-------------------------------------
+// prof
+//-------------------------------------
+// per unit timing, only compiled in with -DPROFILE (make profile). wrap a
+// call in PROF("name", ...) to add its time to the unit with that name;
+// without PROFILE the macro is just the call. units can nest (a PROF inside
+// a graph node): each keeps its total time and its own time without the
+// units inside it, so the shares of the period prof_print shows are of own
+// time and add up to at most 100%
+#define PROF_MAX_UNITS 64
+
+#ifdef PROFILE
+typedef struct {
+  const char *name;
+  uint64_t ns, self_ns, calls;
+} prof_unit_t;
+
+struct {
+  prof_unit_t units[PROF_MAX_UNITS];
+  int num_units, lock;
+  uint64_t period_ns;
+} prof;
+
+// time spent in units nested in the one running on this thread
+__thread uint64_t prof_nested;
+
+//-------------------------------------
+uint64_t prof_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+//-------------------------------------
+// only called the first time through each call site, so it can lock
+int prof_unit(const char *name) {
+  while (__atomic_test_and_set(&prof.lock, __ATOMIC_ACQUIRE))
+    ;
+
+  int id = 0;
+  while (id < prof.num_units && strcmp(prof.units[id].name, name))
+    id++;
+
+  if (id == prof.num_units && id < PROF_MAX_UNITS)
+    prof.units[prof.num_units++].name = name;
+
+  __atomic_clear(&prof.lock, __ATOMIC_RELEASE);
+  return id < PROF_MAX_UNITS ? id : -1;
+}
+
+//-------------------------------------
+void prof_add(int id, uint64_t ns, uint64_t self_ns) {
+  if (id < 0)
+    return;
+  __atomic_fetch_add(&prof.units[id].ns, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&prof.units[id].self_ns, self_ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&prof.units[id].calls, 1, __ATOMIC_RELAXED);
+}
+
+//-------------------------------------
+void prof_period(int frames) {
+  __atomic_fetch_add(&prof.period_ns, (uint64_t)(frames / audio.rate * 1e9),
+                     __ATOMIC_RELAXED);
+}
+
+//-------------------------------------
+void prof_print() {
+  double period = __atomic_load_n(&prof.period_ns, __ATOMIC_RELAXED);
+  if (period == 0)
+    return;
+
+  printf("[prof] %-16s %10s %10s %8s %8s\n", "unit", "calls", "ns/call",
+         "period", "total");
+  loop(u, __atomic_load_n(&prof.num_units, __ATOMIC_ACQUIRE)) {
+    prof_unit_t *U = &prof.units[u];
+    if (U->calls == 0)
+      continue;
+    printf("[prof] %-16s %10lu %10.0f %7.2f%% %7.2f%%\n", U->name, U->calls,
+           (double)U->ns / U->calls, U->self_ns / period * 100,
+           U->ns / period * 100);
   }
 }
 
+// PROF_AT takes a unit id from prof_unit, for call sites shared by units
+#define PROF_AT(id, ...)                                                       \
+  {                                                                            \
+    uint64_t prof_outer = prof_nested, prof_start = prof_now();                \
+    prof_nested = 0;                                                           \
+    __VA_ARGS__;                                                               \
+    uint64_t prof_ns = prof_now() - prof_start;                                \
+    prof_add(id, prof_ns, prof_ns - prof_nested);                              \
+    prof_nested = prof_outer + prof_ns;                                        \
+  }
+#define PROF(name, ...)                                                        \
+  {                                                                            \
+    static int prof_id = -2;                                                   \
+    if (prof_id == -2)                                                         \
+      prof_id = prof_unit(name);                                               \
+    PROF_AT(prof_id, __VA_ARGS__);                                             \
+  }
+#else
+#define PROF_AT(id, ...)                                                       \
+  { __VA_ARGS__; }
+#define PROF(name, ...)                                                        \
+  { __VA_ARGS__; }
+#define prof_print()
+#endif
+
 //-------------------------------------
 // misc
 //-------------------------------------
@@ -237,95 +821,317 @@ sample_t effect_bit(sample_t input, int bit) {
 }
 
 //-------------------------------------
-bool audio_every(int t) { return audio.pos % t == 0; }
-
+// block
 //-------------------------------------
-void audio_out(sample_t s) {
-  sample_loop audio.buf_out[c][audio.pos] += s.value[c];
+// vectorised versions of the sample_* and effect_* functions above. these
+// run over a single planar channel (call them once per channel), and out may
+// be the same buffer as the input
+#if defined(__AVX__)
+#define VEC_SIZE 8
+typedef __m256 vec_t;
+#define vec_load _mm256_loadu_ps
+#define vec_store _mm256_storeu_ps
+#define vec_set1 _mm256_set1_ps
+#define vec_add _mm256_add_ps
+#define vec_sub _mm256_sub_ps
+#define vec_mul _mm256_mul_ps
+#define vec_div _mm256_div_ps
+#define vec_min _mm256_min_ps
+#define vec_max _mm256_max_ps
+#define vec_floor _mm256_floor_ps
+#define vec_lt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vec_gt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define vec_select(m, a, b) _mm256_blendv_ps(b, a, m)
+#elif defined(__SSE2__)
+#define VEC_SIZE 4
+typedef __m128 vec_t;
+#define vec_load _mm_loadu_ps
+#define vec_store _mm_storeu_ps
+#define vec_set1 _mm_set1_ps
+#define vec_add _mm_add_ps
+#define vec_sub _mm_sub_ps
+#define vec_mul _mm_mul_ps
+#define vec_div _mm_div_ps
+#define vec_min _mm_min_ps
+#define vec_max _mm_max_ps
+#define vec_lt _mm_cmplt_ps
+#define vec_gt _mm_cmpgt_ps
+#define vec_select(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#ifdef __SSE4_1__
+#define vec_floor _mm_floor_ps
+#else
+vec_t vec_floor(vec_t x) {
+  vec_t t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1)));
 }
+#endif
+#endif
 
-//-------------------------------------
-void audio_set(sample_t s) {
-  sample_loop audio.buf_out[c][audio.pos] = s.value[c];
+#ifdef VEC_SIZE
+#define block_loop(i, n) for (; i + VEC_SIZE <= n; i += VEC_SIZE)
+
+// 0, 1, 2, ... one per lane
+const float vec_ramp[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+// t[x], linearly interpolated, for positions 0 <= x < len (t needs a guard
+// point at t[len])
+vec_t vec_table(const float *t, vec_t x) {
+  vec_t f = vec_floor(x), frac = vec_sub(x, f), a, b;
+#ifdef __AVX2__
+  __m256i i = _mm256_cvttps_epi32(f);
+  a = _mm256_i32gather_ps(t, i, 4), b = _mm256_i32gather_ps(t + 1, i, 4);
+#else
+  float idx[VEC_SIZE], A[VEC_SIZE], B[VEC_SIZE];
+  vec_store(idx, f);
+  loop(k, VEC_SIZE) A[k] = t[(int)idx[k]], B[k] = t[(int)idx[k] + 1];
+  a = vec_load(A), b = vec_load(B);
+#endif
+  return vec_add(a, vec_mul(frac, vec_sub(b, a)));
 }
 
-//-------------------------------------
-sample_t audio_get() {
-  sample_t s = sample_zero;
-  sample_loop s.value[c] = audio.buf_out[c][audio.pos];
-  return s;
+// t[i * stride] for each lane's whole number i
+vec_t vec_gather(const float *t, vec_t i, int stride) {
+#ifdef __AVX2__
+  __m256i k = _mm256_mullo_epi32(_mm256_cvttps_epi32(i),
+                                 _mm256_set1_epi32(stride));
+  return _mm256_i32gather_ps(t, k, 4);
+#else
+  float idx[VEC_SIZE], x[VEC_SIZE];
+  vec_store(idx, i);
+  loop(k, VEC_SIZE) x[k] = t[(int)idx[k] * stride];
+  return vec_load(x);
+#endif
 }
+#endif
 
 //-------------------------------------
-sample_t audio_in() {
-  sample_t s = {0, 0};
-  sample_loop s.value[c] = audio.buf_in[c][audio.pos];
-  return s;
+void block_add(float *out, const float *a, const float *b, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  block_loop(i, n) {
+    vec_store(out + i, vec_add(vec_load(a + i), vec_load(b + i)));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = a[i] + b[i];
 }
 
 //-------------------------------------
-int sec2samp(float sec) { return (int)floorf(sec * audio.rate); }
-int samp2sec(int samp) { return (float)(samp / audio.rate); }
+void block_mul(float *out, const float *a, const float *b, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  block_loop(i, n) {
+    vec_store(out + i, vec_mul(vec_load(a + i), vec_load(b + i)));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = a[i] * b[i];
+}
 
 //-------------------------------------
-// gate
+void block_mul_s(float *out, const float *a, float s, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t S = vec_set1(s);
+  block_loop(i, n) vec_store(out + i, vec_mul(vec_load(a + i), S));
+#endif
+  for (; i < n; ++i)
+    out[i] = a[i] * s;
+}
+
 //-------------------------------------
-typedef struct {
-  bool value;
-  float prev, threshold;
-} gate_t;
-typedef gate_t *gate_p;
+void block_lincomb(float *out, const float *a, float x, const float *b, float y,
+                   int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t X = vec_set1(x), Y = vec_set1(y);
+  block_loop(i, n) {
+    vec_t A = vec_mul(vec_load(a + i), X), B = vec_mul(vec_load(b + i), Y);
+    vec_store(out + i, vec_add(A, B));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = a[i] * x + b[i] * y;
+}
 
 //-------------------------------------
-void gate_init(gate_t *G) { ZERO(G, gate_t); }
+void block_clip(float *out, const float *a, float min, float max, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t lo = vec_set1(min), hi = vec_set1(max);
+  block_loop(i, n) {
+    vec_store(out + i, vec_min(vec_max(vec_load(a + i), lo), hi));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = CLIP(a[i], min, max);
+}
 
 //-------------------------------------
-gate_t *gate_new() {
-  gate_t *G = malloc(sizeof(gate_t));
-  gate_init(G);
-  return G;
+void block_wrap(float *out, const float *a, float min, float max, int n) {
+  float r = max - min;
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t lo = vec_set1(min), hi = vec_set1(max), R = vec_set1(r);
+  block_loop(i, n) {
+    vec_t x = vec_load(a + i);
+    vec_t d1 = vec_sub(lo, x), d2 = vec_sub(x, hi);
+    d1 = vec_sub(d1, vec_mul(R, vec_floor(vec_div(d1, R))));
+    d2 = vec_sub(d2, vec_mul(R, vec_floor(vec_div(d2, R))));
+    x = vec_select(vec_gt(x, hi), vec_add(lo, d2), x);
+    x = vec_select(vec_lt(vec_load(a + i), lo), vec_sub(hi, d1), x);
+    vec_store(out + i, x);
+  }
+#endif
+  for (; i < n; ++i) {
+    if (a[i] < min)
+      out[i] = max - fmodf(min - a[i], r);
+    else if (a[i] > max)
+      out[i] = min + fmodf(a[i] - max, r);
+    else
+      out[i] = a[i];
+  }
 }
 
 //-------------------------------------
-bool gate_update(gate_t *G, float input) {
-  G->value = G->prev < G->threshold && input >= G->threshold;
-  G->prev = input;
+void effect_overdrive_block(float *out, const float *in, float amt, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t A = vec_set1(amt), lo = vec_set1(-1), hi = vec_set1(1);
+  block_loop(i, n) {
+    vec_t x = vec_mul(vec_load(in + i), A);
+    vec_store(out + i, vec_min(vec_max(x, lo), hi));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = CLIP(in[i] * amt, -1, 1);
+}
 
-  return G->value;
+//-------------------------------------
+void effect_fold_block(float *out, const float *in, float amt, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t A = vec_set1(amt), A2 = vec_set1(2 * amt), lo = vec_set1(-1);
+  block_loop(i, n) {
+    vec_t x = vec_load(in + i);
+    vec_t y = vec_select(vec_lt(x, lo), vec_sub(x, A2), x);
+    vec_store(out + i, vec_select(vec_gt(x, A), vec_sub(A2, x), y));
+  }
+#endif
+  for (; i < n; ++i) {
+    if (in[i] > amt)
+      out[i] = amt - (in[i] - amt);
+    else if (in[i] < -1.0)
+      out[i] = -(amt - (in[i] - amt));
+    else
+      out[i] = in[i];
+  }
 }
 
 //-------------------------------------
-// oscil
+void effect_bit_block(float *out, const float *in, float bit, int n) {
+  float r = (float)1.0 / bit;
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t R = vec_set1(r);
+  block_loop(i, n) {
+    vec_t x = vec_floor(vec_div(vec_load(in + i), R));
+    vec_store(out + i, vec_mul(x, R));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] = nearest(in[i], r);
+}
+
 //-------------------------------------
-typedef struct {
-  sample_t value;
-  float freq, phase;
-} oscil_t;
-typedef oscil_t *oscil_p;
-void oscil_init(oscil_t *O);
-sample_t oscil_update(oscil_t *O);
+// out[i] = sum of h[j] * a[i + j], so a holds n + taps - 1 samples
+void block_fir(float *out, const float *a, const float *h, int taps, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  // four vectors at a time, so the adds don't wait on each other
+  for (; i + 4 * VEC_SIZE <= n; i += 4 * VEC_SIZE) {
+    vec_t acc[4];
+    loop(k, 4) acc[k] = vec_set1(0);
+    loop(j, taps) {
+      vec_t H = vec_set1(h[j]);
+      loop(k, 4) {
+        vec_t x = vec_load(a + i + j + k * VEC_SIZE);
+        acc[k] = vec_add(acc[k], vec_mul(H, x));
+      }
+    }
+    loop(k, 4) vec_store(out + i + k * VEC_SIZE, acc[k]);
+  }
+  block_loop(i, n) {
+    vec_t acc = vec_set1(0);
+    loop(j, taps) {
+      acc = vec_add(acc, vec_mul(vec_set1(h[j]), vec_load(a + i + j)));
+    }
+    vec_store(out + i, acc);
+  }
+#endif
+  for (; i < n; ++i) {
+    float acc = 0;
+    loop(j, taps) acc += h[j] * a[i + j];
+    out[i] = acc;
+  }
+}
 
 //-------------------------------------
-void oscil_init(oscil_t *O) {
-  ZERO(O, oscil_t);
-  O->freq = 440;
+bool audio_every(int t) { return audio.pos % t == 0; }
+
+//-------------------------------------
+void audio_out(sample_t s) {
+  sample_loop bus_out(c)[audio.pos] += s.value[c];
 }
 
 //-------------------------------------
-oscil_t *oscil_new() {
-  oscil_t *O = NEW(oscil_t);
-  oscil_init(O);
-  return O;
+void audio_set(sample_t s) {
+  sample_loop bus_out(c)[audio.pos] = s.value[c];
 }
 
 //-------------------------------------
-sample_t oscil_update(oscil_t *O) {
-  O->value.value[0] = O->value.value[1] = sin(O->phase * PI);
-  O->phase += O->freq / audio.rate;
-  while (O->phase > TAU)
-    O->phase -= TAU;
+sample_t audio_get() {
+  sample_t s = sample_zero;
+  sample_loop s.value[c] = bus_out(c)[audio.pos];
+  return s;
+}
 
-  return O->value;
+//-------------------------------------
+sample_t audio_in() {
+  sample_t s = {0, 0};
+  sample_loop s.value[c] = bus_in(c)[audio.pos];
+  return s;
+}
+
+//-------------------------------------
+int sec2samp(float sec) { return (int)floorf(sec * audio.rate); }
+int samp2sec(int samp) { return (float)(samp / audio.rate); }
+
+//-------------------------------------
+// gate
+//-------------------------------------
+typedef struct {
+  bool value;
+  float prev, threshold;
+} gate_t;
+typedef gate_t *gate_p;
+
+//-------------------------------------
+void gate_init(gate_t *G) { ZERO(G, gate_t); }
+
+//-------------------------------------
+gate_t *gate_new() {
+  gate_t *G = MEM_NEW(gate_t);
+  gate_init(G);
+  return G;
+}
+
+//-------------------------------------
+bool gate_update(gate_t *G, float input) {
+  G->value = G->prev < G->threshold && input >= G->threshold;
+  G->prev = input;
+
+  return G->value;
 }
 
 //-------------------------------------
@@ -345,30 +1151,33 @@ float buffer_read1(buffer_t *B, int pos, uint chan);
 sample_t buffer_read(buffer_t *B, int pos);
 void buffer_write(buffer_t *B, int pos, sample_t in);
 float buffer_rate_scale(buffer_t *B, float rate);
+void buffer_sinc_init();
 
 //-------------------------------------
-void buffer_destroy(buffer_t *B) { FREE(B->data); }
+void buffer_destroy(buffer_t *B) { MEM_FREE(B->data); }
 
 //-------------------------------------
 void buffer_init(buffer_t *B, uint len, uint chans) {
   ZERO(B, buffer_t);
+  buffer_sinc_init();
 
   B->rate = audio.rate;
   B->len = len, B->chans = chans, B->size = B->len * B->chans;
-  B->data = calloc(B->size, sizeof(float));
+  B->data = mem_calloc(B->size, sizeof(float));
 }
 
 //-------------------------------------
 buffer_t *buffer_new() {
-  buffer_t *B = malloc(sizeof(buffer_t));
+  buffer_t *B = MEM_NEW(buffer_t);
   ZERO(B, buffer_t);
   return B;
 }
 
 //-------------------------------------
 void buffer_load(buffer_t *B, const char *filename) {
-  FREE(B->data);
+  MEM_FREE(B->data);
   ZERO(B, buffer_t);
+  buffer_sinc_init();
 
   drwav wav;
   drwav_uint64 len;
@@ -423,6 +1232,1030 @@ float buffer_rate_scale(buffer_t *B, float rate) {
   return rate * (B->rate / audio.rate);
 }
 
+//-------------------------------------
+// span reads: n frames from pos, pos + inc, ... interpolated, into out[0]
+// and out[1] (a mono buffer fills both). positions past either end read the
+// edge frame. windowed sinc interpolates its kernel between the two nearest
+// phases, and switches to a lower cutoff as inc passes 1 and 2, so reading
+// faster doesn't alias as much
+typedef enum { BUFFER_LINEAR, BUFFER_CUBIC, BUFFER_SINC } buffer_interp_t;
+
+#define BUFFER_SINC_TAPS 16
+#define BUFFER_SINC_PHASES 256
+#define BUFFER_SINC_BANDS 3
+#define BUFFER_SPAN 256
+
+// [band][phase][tap], tap j is at frame k + j - (TAPS / 2 - 1)
+float buffer_sinc[BUFFER_SINC_BANDS][BUFFER_SINC_PHASES + 1]
+                 [BUFFER_SINC_TAPS];
+
+//-------------------------------------
+// blackman windowed, each phase normalised to unity gain
+void buffer_sinc_fill() {
+  float half = BUFFER_SINC_TAPS / 2;
+  loop(b, BUFFER_SINC_BANDS) {
+    float cut = 0.9 / (1 << b);
+    loop(p, BUFFER_SINC_PHASES + 1) {
+      float *h = buffer_sinc[b][p], sum = 0;
+      loop(j, BUFFER_SINC_TAPS) {
+        double x = j - (half - 1) - (double)p / BUFFER_SINC_PHASES;
+        double w = 0.42 + 0.5 * cos(PI * x / half) + 0.08 * cos(TAU * x / half);
+        double s = x == 0 ? 1 : sin(PI * cut * x) / (PI * cut * x);
+        h[j] = fabs(x) < half ? s * w : 0;
+        sum += h[j];
+      }
+      loop(j, BUFFER_SINC_TAPS) h[j] /= sum;
+    }
+  }
+}
+
+// filled once, whichever thread gets here first
+pthread_once_t buffer_sinc_once = PTHREAD_ONCE_INIT;
+void buffer_sinc_init() { pthread_once(&buffer_sinc_once, buffer_sinc_fill); }
+
+//-------------------------------------
+// one frame, for the edges, clamped
+float buffer_interp(buffer_t *B, double pos, uint c, buffer_interp_t interp,
+                    int band) {
+  int k = floor(pos), last = B->len - 1;
+  float f = pos - k;
+  const float *x = B->data + c;
+  int s = B->chans;
+#define AT(i) x[CLIP(k + (i), 0, last) * s]
+
+  switch (interp) {
+  case BUFFER_CUBIC: {
+    float a = AT(-1), b = AT(0), c1 = AT(1), d = AT(2);
+    return b + 0.5 * f *
+                   (c1 - a +
+                    f * (2 * a - 5 * b + 4 * c1 - d +
+                         f * (3 * (b - c1) + d - a)));
+  }
+
+  case BUFFER_SINC: {
+    float p = f * BUFFER_SINC_PHASES;
+    int ip = MIN((int)p, BUFFER_SINC_PHASES - 1);
+    const float *h0 = buffer_sinc[band][ip], *h1 = h0 + BUFFER_SINC_TAPS;
+    float sum = 0;
+    loop(j, BUFFER_SINC_TAPS) {
+      float h = h0[j] + (p - ip) * (h1[j] - h0[j]);
+      sum += h * AT(j - (BUFFER_SINC_TAPS / 2 - 1));
+    }
+    return sum;
+  }
+
+  default:
+    return AT(0) + f * (AT(1) - AT(0));
+  }
+#undef AT
+}
+
+//-------------------------------------
+// one channel of up to BUFFER_SPAN frames, all of whose taps are inside the
+// buffer. t is the frame pos starts in, x the offset from it
+void buffer_span1(const float *t, int s, float *out, float x, float inc, int n,
+                  buffer_interp_t interp, int band) {
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t X = vec_add(vec_set1(x), vec_mul(vec_load(vec_ramp), vec_set1(inc)));
+  vec_t step = vec_set1(inc * VEC_SIZE);
+
+  block_loop(i, n) {
+    vec_t k = vec_floor(X), f = vec_sub(X, k), y;
+
+    if (interp == BUFFER_CUBIC) {
+      vec_t a = vec_gather(t - s, k, s), b = vec_gather(t, k, s);
+      vec_t c = vec_gather(t + s, k, s), d = vec_gather(t + 2 * s, k, s);
+      // b + f/2 (c - a + f (2a - 5b + 4c - d + f (3 (b - c) + d - a)))
+      vec_t r = vec_add(vec_mul(vec_set1(3), vec_sub(b, c)), vec_sub(d, a));
+      vec_t q = vec_sub(vec_add(vec_add(a, a), vec_mul(vec_set1(4), c)),
+                        vec_add(vec_mul(vec_set1(5), b), d));
+      q = vec_add(q, vec_mul(f, r));
+      q = vec_add(vec_sub(c, a), vec_mul(f, q));
+      y = vec_add(b, vec_mul(vec_mul(vec_set1(0.5), f), q));
+    } else if (interp == BUFFER_SINC) {
+      // the kernel between the two nearest phases
+      vec_t p = vec_mul(f, vec_set1(BUFFER_SINC_PHASES));
+      vec_t phase = vec_min(vec_floor(p), vec_set1(BUFFER_SINC_PHASES - 1));
+      vec_t fp = vec_sub(p, phase);
+      const float *h0 = buffer_sinc[band][0], *h1 = buffer_sinc[band][1];
+      y = vec_set1(0);
+      loop(j, BUFFER_SINC_TAPS) {
+        vec_t v = vec_gather(t + (j - (BUFFER_SINC_TAPS / 2 - 1)) * s, k, s);
+        vec_t w0 = vec_gather(h0 + j, phase, BUFFER_SINC_TAPS);
+        vec_t w1 = vec_gather(h1 + j, phase, BUFFER_SINC_TAPS);
+        vec_t w = vec_add(w0, vec_mul(fp, vec_sub(w1, w0)));
+        y = vec_add(y, vec_mul(v, w));
+      }
+    } else {
+      vec_t a = vec_gather(t, k, s), b = vec_gather(t + s, k, s);
+      y = vec_add(a, vec_mul(f, vec_sub(b, a)));
+    }
+
+    vec_store(out + i, y);
+    X = vec_add(X, step);
+  }
+#endif
+  for (; i < n; ++i) {
+    float p = x + inc * i;
+    int k = floorf(p);
+    float f = p - k;
+    const float *a = t + k * s;
+
+    if (interp == BUFFER_CUBIC)
+      out[i] = a[0] + 0.5 * f *
+                          (a[s] - a[-s] +
+                           f * (2 * a[-s] - 5 * a[0] + 4 * a[s] - a[2 * s] +
+                                f * (3 * (a[0] - a[s]) + a[2 * s] - a[-s])));
+    else if (interp == BUFFER_SINC) {
+      float p = f * BUFFER_SINC_PHASES;
+      int ip = MIN((int)p, BUFFER_SINC_PHASES - 1);
+      const float *h0 = buffer_sinc[band][ip], *h1 = h0 + BUFFER_SINC_TAPS;
+      float sum = 0;
+      loop(j, BUFFER_SINC_TAPS) {
+        float h = h0[j] + (p - ip) * (h1[j] - h0[j]);
+        sum += h * a[(j - (BUFFER_SINC_TAPS / 2 - 1)) * s];
+      }
+      out[i] = sum;
+    } else
+      out[i] = a[0] + f * (a[s] - a[0]);
+  }
+}
+
+//-------------------------------------
+void buffer_span(buffer_t *B, float *out[2], double pos, double inc, int n,
+                 buffer_interp_t interp) {
+  if (!B->data || B->len < 2) {
+    sample_loop memset(out[c], 0, MAX(n, 0) * sizeof(float));
+    return;
+  }
+
+  int band = fabs(inc) > 2 ? 2 : fabs(inc) > 1 ? 1 : 0;
+  int reach = interp == BUFFER_SINC    ? BUFFER_SINC_TAPS / 2
+              : interp == BUFFER_CUBIC ? 2
+                                       : 1;
+  uint chans = MIN(B->chans, 2);
+  // signed, so a buffer shorter than the kernel never takes the fast path
+  double edge = (double)B->len - 1 - reach;
+  bool fits = B->len >= 2 * reach + 2;
+
+  for (int i = 0; i < n; i += BUFFER_SPAN) {
+    int m = MIN(n - i, BUFFER_SPAN);
+    double first = pos + inc * i, last = first + inc * (m - 1);
+    double lo = MIN(first, last), hi = MAX(first, last);
+
+    // near an edge, frame by frame with clamping
+    if (!fits || lo < reach || hi >= edge) {
+      loop(c, chans) loop(j, m) {
+        out[c][i + j] = buffer_interp(B, first + inc * j, c, interp, band);
+      }
+    } else {
+      int k = floor(first);
+      loop(c, chans) {
+        buffer_span1(B->data + k * B->chans + c, B->chans, out[c] + i,
+                     first - k, inc, m, interp, band);
+      }
+    }
+
+    if (chans == 1)
+      memcpy(out[1] + i, out[0] + i, m * sizeof(float));
+  }
+}
+
+//-------------------------------------
+// resample
+//-------------------------------------
+// converts a buffer to another rate once, at load time, so playback can run
+// at unity: a polyphase windowed sinc, its phases linearly interpolated and
+// its cutoff lowered when going down. buffer_load_rate keeps the result in
+// a cache (COMPAKT_CACHE, or ~/.cache/compakt) keyed by a hash of the file
+// and the rate, so the next start reads it straight back.
+// buffer_load_many loads a list of files on a thread per core
+#define RESAMPLE_TAPS 64
+#define RESAMPLE_PHASES 512
+#define RESAMPLE_MAGIC "cmpktbuf"
+#define RESAMPLE_MAX_THREADS 16
+
+typedef struct {
+  char magic[8];
+  uint32_t chans, rate;
+  uint64_t len, hash;
+} resample_header_t;
+
+//-------------------------------------
+// fnv-1a
+uint64_t resample_hash(const unsigned char *data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325;
+  loop(i, size) h = (h ^ data[i]) * 0x100000001b3;
+  return h;
+}
+
+//-------------------------------------
+void buffer_resample(buffer_t *B, uint rate) {
+  if (!B->data || !B->len || !rate || B->rate == rate)
+    return;
+
+  double ratio = (double)rate / B->rate;
+  double cut = 0.95 * MIN(ratio, 1);
+
+  // the same number of zero crossings whichever way it goes
+  int taps = (int)ceil(RESAMPLE_TAPS / cut / 2) * 2, half = taps / 2;
+  float *h = malloc((RESAMPLE_PHASES + 1) * taps * sizeof(float));
+  loop(p, RESAMPLE_PHASES + 1) {
+    loop(j, taps) {
+      double x = j - (half - 1) - (double)p / RESAMPLE_PHASES;
+      double w = 0.42 + 0.5 * cos(PI * x / half) + 0.08 * cos(TAU * x / half);
+      double s = x == 0 ? 1 : sin(PI * cut * x) / (PI * cut * x);
+      h[p * taps + j] = fabs(x) < half ? cut * s * w : 0;
+    }
+  }
+
+  uint chans = B->chans, len = floor(B->len * ratio);
+  float *out = malloc((size_t)len * chans * sizeof(float));
+
+  loop(n, len) {
+    double pos = n / ratio;
+    int k = floor(pos);
+    float p = (pos - k) * RESAMPLE_PHASES;
+    int ip = MIN((int)p, RESAMPLE_PHASES - 1);
+    float fp = p - ip;
+    const float *h0 = h + ip * taps, *h1 = h0 + taps;
+
+    loop(c, chans) {
+      float sum = 0;
+      loop(j, taps) {
+        int i = k + j - (half - 1);
+        if (i >= 0 && i < (int)B->len)
+          sum += (h0[j] + fp * (h1[j] - h0[j])) * B->data[i * chans + c];
+      }
+      out[n * chans + c] = sum;
+    }
+  }
+
+  free(h);
+  MEM_FREE(B->data);
+  B->data = out;
+  B->rate = rate, B->len = len, B->size = len * chans;
+}
+
+//-------------------------------------
+void resample_cache_path(char *path, size_t size, uint64_t hash, uint rate) {
+  const char *dir = getenv("COMPAKT_CACHE"), *home = getenv("HOME");
+  char base[1024];
+
+  if (dir)
+    snprintf(base, sizeof(base), "%s", dir);
+  else
+    snprintf(base, sizeof(base), "%s/.cache/compakt", home ? home : "/tmp");
+
+  // one level at a time, existing ones are fine
+  for (char *s = strchr(base + 1, '/'); s; s = strchr(s + 1, '/')) {
+    *s = 0;
+    mkdir(base, 0755);
+    *s = '/';
+  }
+  mkdir(base, 0755);
+
+  snprintf(path, size, "%s/%016llx-%u.buf", base, (unsigned long long)hash,
+           rate);
+}
+
+//-------------------------------------
+bool resample_cache_read(buffer_t *B, const char *path, uint64_t hash,
+                         uint rate) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  resample_header_t H;
+  bool ok = fread(&H, sizeof(H), 1, file) == 1 &&
+            !memcmp(H.magic, RESAMPLE_MAGIC, 8) && H.hash == hash &&
+            H.rate == rate && H.chans > 0;
+
+  if (ok) {
+    size_t size = H.len * H.chans;
+    B->data = malloc(size * sizeof(float));
+    ok = fread(B->data, sizeof(float), size, file) == size;
+    B->len = H.len, B->chans = H.chans, B->rate = H.rate, B->size = size;
+    if (!ok)
+      MEM_FREE(B->data);
+  }
+
+  fclose(file);
+  return ok;
+}
+
+//-------------------------------------
+// through a temporary file, so a half written one is never read
+void resample_cache_write(buffer_t *B, const char *path, uint64_t hash) {
+  char tmp[1100];
+  snprintf(tmp, sizeof(tmp), "%s.%i.tmp", path, (int)getpid());
+
+  FILE *file = fopen(tmp, "wb");
+  if (!file) {
+    printf("[resample error] unable to write %s\n", tmp);
+    return;
+  }
+
+  resample_header_t H = {.chans = B->chans, .rate = B->rate, .len = B->len,
+                         .hash = hash};
+  memcpy(H.magic, RESAMPLE_MAGIC, 8);
+  bool ok = fwrite(&H, sizeof(H), 1, file) == 1 &&
+            fwrite(B->data, sizeof(float), B->size, file) == B->size;
+  fclose(file);
+
+  if (ok)
+    rename(tmp, path);
+  else
+    remove(tmp);
+}
+
+//-------------------------------------
+// buffer_load, then to rate through the cache. 0 keeps the file's rate,
+// which is just buffer_load
+int buffer_load_rate(buffer_t *B, const char *filename, uint rate) {
+  if (!rate) {
+    buffer_load(B, filename);
+    return B->data ? 0 : -1;
+  }
+
+  MEM_FREE(B->data);
+  ZERO(B, buffer_t);
+  buffer_sinc_init();
+
+  size_t size = 0;
+  unsigned char *file = NULL;
+  FILE *F = fopen(filename, "rb");
+  if (F) {
+    long end = fseek(F, 0, SEEK_END) ? -1 : ftell(F);
+    if (end > 0 && !fseek(F, 0, SEEK_SET)) {
+      size = end;
+      file = malloc(size);
+    }
+    if (file && fread(file, 1, size, F) != size)
+      FREE(file);
+    fclose(F);
+  }
+
+  if (!file) {
+    printf("[resample error] unable to read %s\n", filename);
+    return -1;
+  }
+
+  uint64_t hash = resample_hash(file, size);
+  char path[1024];
+  resample_cache_path(path, sizeof(path), hash, rate);
+  if (resample_cache_read(B, path, hash, rate)) {
+    free(file);
+    return 0;
+  }
+
+  drwav_uint64 len;
+  uint chans, file_rate;
+  B->data = drwav_open_memory_and_read_pcm_frames_f32(file, size, &chans,
+                                                      &file_rate, &len, NULL);
+  free(file);
+
+  if (!B->data) {
+    printf("[resample error] unable to decode %s\n", filename);
+    return -1;
+  }
+
+  B->rate = file_rate, B->chans = chans, B->len = len;
+  B->size = B->len * B->chans;
+
+  if (rate != file_rate) {
+    buffer_resample(B, rate);
+    resample_cache_write(B, path, hash);
+  }
+
+  return 0;
+}
+
+//-------------------------------------
+typedef struct {
+  buffer_t **B;
+  const char **files;
+  int num, next;
+  uint rate;
+} resample_jobs_t;
+
+//-------------------------------------
+void *resample_worker(void *X) {
+  resample_jobs_t *J = X;
+  int i;
+  while ((i = __atomic_fetch_add(&J->next, 1, __ATOMIC_ACQ_REL)) < J->num)
+    buffer_load_rate(J->B[i], J->files[i], J->rate);
+  return NULL;
+}
+
+//-------------------------------------
+// each of files into B (already allocated), spread over the cores
+void buffer_load_many(buffer_t **B, const char **files, int num, uint rate) {
+  resample_jobs_t J = {B, files, num, 0, rate};
+  pthread_t threads[RESAMPLE_MAX_THREADS];
+
+  buffer_sinc_init();
+
+  int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  num_threads = CLIP(MIN(num_threads, num), 1, RESAMPLE_MAX_THREADS);
+
+  int started = 0;
+  for (; started < num_threads - 1; ++started) {
+    if (pthread_create(&threads[started], NULL, resample_worker, &J))
+      break;
+  }
+  resample_worker(&J);
+  loop(t, started) pthread_join(threads[t], NULL);
+}
+
+//-------------------------------------
+// stream
+//-------------------------------------
+// a file too long to hold in memory. the first head frames are loaded up
+// front (into an ordinary buffer_t), and everything after them is read ahead
+// into a ring by one background thread shared by every stream. the audio
+// thread is the only reader: stream_span reads like buffer_span, only ever
+// moving forward through the ring, and stream_seek jumps (anything in the
+// head plays straight away while the ring refills). frames that aren't there
+// yet come out as silence and are counted in underruns, it never waits.
+// the ring itself is single producer / single consumer, with a generation
+// counter so a seek can throw away whatever was read ahead
+#define STREAM_MAX 64
+#define STREAM_HEAD 2 // seconds
+#define STREAM_RING (1 << 17)
+#define STREAM_CHUNK 4096
+#define STREAM_SPAN 1024
+#define STREAM_GUARD (BUFFER_SINC_TAPS / 2 + 2)
+#define STREAM_POLL 20 // ms
+
+typedef struct {
+  buffer_t head;
+  uint len, chans, rate;
+
+  // frames [read, write) of the file are in the ring, at frame & mask
+  float *ring, *tmp;
+  uint mask;
+  uint read, write;
+
+  // the audio thread asks for a seek to frame seek by bumping gen, the
+  // stream thread answers by setting filled to it once the ring starts there
+  uint seek, gen, filled;
+
+  drwav wav;
+  bool open;
+  uint underruns, missed;
+} stream_t;
+typedef stream_t *stream_p;
+
+int stream_init(stream_t *S, const char *filename, uint head);
+stream_t *stream_new(const char *filename, uint head);
+void stream_destroy(stream_t *S);
+void stream_seek(stream_t *S, int frame);
+void stream_span(stream_t *S, float *out[2], double pos, double inc, int n,
+                 buffer_interp_t interp);
+uint stream_underruns(stream_t *S);
+
+struct {
+  stream_t *list[STREAM_MAX];
+  int num;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  sem_t wake;
+  bool running, quit, pending;
+} stream_io = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+//-------------------------------------
+// tops up one stream's ring, from the stream thread
+void stream_fill(stream_t *S) {
+  uint gen = __atomic_load_n(&S->gen, __ATOMIC_ACQUIRE);
+  if (gen != S->filled) {
+    uint seek = S->seek;
+    drwav_seek_to_pcm_frame(&S->wav, seek);
+    __atomic_store_n(&S->write, seek, __ATOMIC_RELEASE);
+    __atomic_store_n(&S->filled, gen, __ATOMIC_RELEASE);
+  }
+
+  uint ring = S->mask + 1;
+  while (__atomic_load_n(&S->gen, __ATOMIC_ACQUIRE) == gen) {
+    // if playback ran past what was read, skip ahead to it
+    uint read = __atomic_load_n(&S->read, __ATOMIC_ACQUIRE);
+    if ((int)(read - S->write) > 0) {
+      drwav_seek_to_pcm_frame(&S->wav, read);
+      __atomic_store_n(&S->write, read, __ATOMIC_RELEASE);
+    }
+
+    uint room = ring - (S->write - read), left = S->len - S->write;
+    if (!left || (room < STREAM_CHUNK && room < left))
+      break;
+
+    uint n = MIN(MIN(room, left), STREAM_CHUNK);
+    n = MIN(n, ring - (S->write & S->mask));
+    float *dst = S->ring + (S->write & S->mask) * S->chans;
+    uint got = drwav_read_pcm_frames_f32(&S->wav, n, dst);
+    if (!got)
+      break;
+
+    __atomic_store_n(&S->write, S->write + got, __ATOMIC_RELEASE);
+  }
+}
+
+//-------------------------------------
+void *stream_loop(void *X) {
+  while (!__atomic_load_n(&stream_io.quit, __ATOMIC_ACQUIRE)) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_nsec += STREAM_POLL * 1000000;
+    t.tv_sec += t.tv_nsec / 1000000000, t.tv_nsec %= 1000000000;
+    sem_timedwait(&stream_io.wake, &t);
+    __atomic_store_n(&stream_io.pending, false, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&stream_io.lock);
+    loop(s, stream_io.num) stream_fill(stream_io.list[s]);
+    pthread_mutex_unlock(&stream_io.lock);
+  }
+
+  return NULL;
+}
+
+//-------------------------------------
+// from the audio thread, only posts if the stream thread isn't already due
+void stream_wake() {
+  if (!__atomic_exchange_n(&stream_io.pending, true, __ATOMIC_ACQ_REL))
+    sem_post(&stream_io.wake);
+}
+
+//-------------------------------------
+// the stream thread runs at normal priority, it only touches the disk
+int stream_start() {
+  if (stream_io.running)
+    return 0;
+
+  sem_init(&stream_io.wake, 0, 0);
+  stream_io.quit = false;
+  if (pthread_create(&stream_io.thread, NULL, stream_loop, NULL)) {
+    printf("[stream error] unable to start the read-ahead thread\n");
+    sem_destroy(&stream_io.wake);
+    return -1;
+  }
+
+  stream_io.running = true;
+  return 0;
+}
+
+//-------------------------------------
+void stream_cleanup() {
+  if (!stream_io.running)
+    return;
+
+  __atomic_store_n(&stream_io.quit, true, __ATOMIC_RELEASE);
+  sem_post(&stream_io.wake);
+  pthread_join(stream_io.thread, NULL);
+  sem_destroy(&stream_io.wake);
+  stream_io.running = false;
+}
+
+//-------------------------------------
+// head is how many frames to keep in memory, 0 for STREAM_HEAD seconds
+int stream_init(stream_t *S, const char *filename, uint head) {
+  ZERO(S, stream_t);
+
+  if (!drwav_init_file(&S->wav, filename, NULL)) {
+    printf("[stream error] unable to open %s\n", filename);
+    return -1;
+  }
+  S->open = true;
+
+  S->len = S->wav.totalPCMFrameCount;
+  S->chans = S->wav.channels, S->rate = S->wav.sampleRate;
+  if (!head)
+    head = STREAM_HEAD * S->rate;
+
+  buffer_init(&S->head, MIN(head, S->len), S->chans);
+  S->head.rate = S->rate;
+  S->head.len = drwav_read_pcm_frames_f32(&S->wav, S->head.len, S->head.data);
+
+  S->mask = STREAM_RING - 1;
+  S->ring = mem_calloc(STREAM_RING * S->chans, sizeof(float));
+  S->tmp = mem_calloc((STREAM_SPAN + 2 * STREAM_GUARD + 2) * S->chans,
+                      sizeof(float));
+
+  // the ring starts where the head stops
+  S->seek = S->read = S->write = S->head.len;
+  S->gen = S->filled = 0;
+
+  if (stream_start()) {
+    stream_destroy(S);
+    return -1;
+  }
+
+  pthread_mutex_lock(&stream_io.lock);
+  bool added = stream_io.num < STREAM_MAX;
+  if (added)
+    stream_io.list[stream_io.num++] = S;
+  pthread_mutex_unlock(&stream_io.lock);
+
+  if (!added) {
+    printf("[stream error] more than %i streams\n", STREAM_MAX);
+    stream_destroy(S);
+    return -1;
+  }
+
+  stream_wake();
+  return 0;
+}
+
+//-------------------------------------
+stream_t *stream_new(const char *filename, uint head) {
+  stream_t *S = MEM_NEW(stream_t);
+  stream_init(S, filename, head);
+  return S;
+}
+
+//-------------------------------------
+void stream_destroy(stream_t *S) {
+  pthread_mutex_lock(&stream_io.lock);
+  loop(s, stream_io.num) {
+    if (stream_io.list[s] == S)
+      stream_io.list[s] = stream_io.list[--stream_io.num];
+  }
+  pthread_mutex_unlock(&stream_io.lock);
+
+  if (S->underruns)
+    printf("[stream] %u underruns, %u frames missed\n", S->underruns,
+           S->missed);
+
+  if (S->open)
+    drwav_uninit(&S->wav);
+  buffer_destroy(&S->head);
+  MEM_FREE(S->ring);
+  MEM_FREE(S->tmp);
+  S->open = false;
+}
+
+//-------------------------------------
+// from the audio thread. a frame inside the head plays at once
+void stream_seek(stream_t *S, int frame) {
+  frame = CLIP(frame, (int)S->head.len, (int)S->len);
+  bool ready = __atomic_load_n(&S->filled, __ATOMIC_ACQUIRE) == S->gen;
+  if ((uint)frame == S->read && ready)
+    return;
+
+  S->seek = frame;
+  __atomic_store_n(&S->read, frame, __ATOMIC_RELAXED);
+  __atomic_store_n(&S->gen, S->gen + 1, __ATOMIC_RELEASE);
+  stream_wake();
+}
+
+//-------------------------------------
+// copies frames [k0, k1] into tmp, clamped to the file. false if any of
+// them aren't in the ring yet
+bool stream_window(stream_t *S, int k0, int k1) {
+  uint chans = S->chans, head = S->head.len;
+  bool ready = __atomic_load_n(&S->filled, __ATOMIC_ACQUIRE) == S->gen;
+  uint write = ready ? __atomic_load_n(&S->write, __ATOMIC_ACQUIRE) : 0;
+
+  // everything from here on is done with, the stream thread can reuse it
+  uint done = CLIP(k0, (int)head, (int)S->len);
+  if (ready && done > S->read) {
+    __atomic_store_n(&S->read, done, __ATOMIC_RELEASE);
+    if (write - done < STREAM_RING / 2)
+      stream_wake();
+  }
+
+  float *tmp = S->tmp;
+  for (int k = k0; k <= k1;) {
+    uint f = CLIP(k, 0, (int)S->len - 1);
+
+    // a run from the head
+    if (f < head) {
+      int n = k < 0 ? 1 : MIN(k1 - k + 1, (int)(head - f));
+      memcpy(tmp, S->head.data + f * chans, n * chans * sizeof(float));
+      tmp += n * chans, k += n;
+      continue;
+    }
+
+    if (!ready || f < S->read || f >= write)
+      return false;
+
+    // a run from the ring, up to its wrap
+    int n = k >= (int)S->len ? 1 : MIN(k1 - k + 1, (int)(write - f));
+    n = MIN(n, (int)(S->mask + 1 - (f & S->mask)));
+    memcpy(tmp, S->ring + (f & S->mask) * chans, n * chans * sizeof(float));
+    tmp += n * chans, k += n;
+  }
+
+  return true;
+}
+
+//-------------------------------------
+// like buffer_span, a piece at a time through tmp
+void stream_span(stream_t *S, float *out[2], double pos, double inc, int n,
+                 buffer_interp_t interp) {
+  if (!S->open || S->len < 2) {
+    sample_loop memset(out[c], 0, MAX(n, 0) * sizeof(float));
+    return;
+  }
+
+  double most = (STREAM_SPAN - 1) / MAX(fabs(inc), 1e-6);
+  for (int i = 0; i < n;) {
+    int m = MIN(n - i, (int)MIN(most, n) + 1);
+    double first = pos + inc * i, last = first + inc * (m - 1);
+    int k0 = floor(MIN(first, last)) - STREAM_GUARD;
+    int k1 = floor(MAX(first, last)) + STREAM_GUARD + 1;
+    float *o[2] = {out[0] + i, out[1] + i};
+
+    if (stream_window(S, k0, k1)) {
+      buffer_t B = {S->tmp, k1 - k0 + 1, (k1 - k0 + 1) * S->chans, S->rate,
+                    S->chans};
+      buffer_span(&B, o, first - k0, inc, m, interp);
+    } else {
+      sample_loop memset(o[c], 0, m * sizeof(float));
+      __atomic_add_fetch(&S->underruns, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&S->missed, m, __ATOMIC_RELAXED);
+    }
+
+    i += m;
+  }
+}
+
+//-------------------------------------
+// how many pieces have come out silent so far, from any thread
+uint stream_underruns(stream_t *S) {
+  return __atomic_load_n(&S->underruns, __ATOMIC_RELAXED);
+}
+
+//-------------------------------------
+// wave
+//-------------------------------------
+// a single cycle waveform, stored once per octave with only the harmonics
+// that fit below nyquist at that octave, so reading it at any pitch doesn't
+// alias. level l has WAVE_HARMONICS >> l harmonics
+#define WAVE_SIZE 2048
+#define WAVE_LEVELS 10
+#define WAVE_HARMONICS (WAVE_SIZE / 4)
+
+typedef enum { WAVE_SINE, WAVE_SAW, WAVE_SQUARE } wave_type_t;
+
+typedef struct {
+  // WAVE_LEVELS tables of WAVE_SIZE, each with a guard point at the end
+  float *data;
+} wave_t;
+typedef wave_t *wave_p;
+void wave_init(wave_t *W, wave_type_t type);
+void wave_init_buffer(wave_t *W, buffer_t *B, uint chan);
+wave_t *wave_new(wave_type_t type);
+void wave_destroy(wave_t *W);
+
+//-------------------------------------
+float *wave_table(wave_t *W, int level) {
+  return W->data + level * (WAVE_SIZE + 1);
+}
+
+//-------------------------------------
+// the first level with no harmonics over nyquist, for a phase increment in
+// cycles per sample
+int wave_level(float inc) {
+  int l = 0;
+  while (l < WAVE_LEVELS - 1 && (WAVE_HARMONICS >> l) * fabsf(inc) > 0.5)
+    l++;
+  return l;
+}
+
+//-------------------------------------
+// fills every level from harmonics 1..num (fftw's c2r convention), scaled so
+// the widest level peaks at 1
+void wave_spectrum(wave_t *W, fftw_complex *harm, int num) {
+  W->data = mem_calloc(WAVE_LEVELS * (WAVE_SIZE + 1), sizeof(float));
+
+  fftw_complex *spec = fftw_alloc_complex(WAVE_SIZE / 2 + 1);
+  double *cycle = fftw_alloc_real(WAVE_SIZE);
+  fftw_plan plan =
+      fftw_plan_dft_c2r_1d(WAVE_SIZE, spec, cycle, FFTW_ESTIMATE);
+  float peak = 0;
+
+  loop(l, WAVE_LEVELS) {
+    memset(spec, 0, (WAVE_SIZE / 2 + 1) * sizeof(fftw_complex));
+    for (int k = 1; k <= MIN(num, WAVE_HARMONICS >> l); ++k)
+      spec[k][0] = harm[k][0], spec[k][1] = harm[k][1];
+    fftw_execute(plan);
+
+    float *t = wave_table(W, l);
+    loop(i, WAVE_SIZE) t[i] = cycle[i];
+    t[WAVE_SIZE] = t[0];
+
+    if (l == 0)
+      loop(i, WAVE_SIZE) peak = MAX(peak, fabsf(t[i]));
+  }
+
+  if (peak > 0)
+    loop(i, WAVE_LEVELS * (WAVE_SIZE + 1)) W->data[i] /= peak;
+
+  fftw_destroy_plan(plan);
+  fftw_free(spec);
+  fftw_free(cycle);
+}
+
+//-------------------------------------
+void wave_init(wave_t *W, wave_type_t type) {
+  ZERO(W, wave_t);
+
+  // sin(k x) * a is -a/2 on the imaginary part
+  fftw_complex harm[WAVE_HARMONICS + 1] = {0};
+  for (int k = 1; k <= WAVE_HARMONICS; ++k) {
+    switch (type) {
+    case WAVE_SINE:
+      harm[k][1] = k == 1 ? -0.5 : 0;
+      break;
+    case WAVE_SAW:
+      harm[k][1] = (k % 2 ? -0.5 : 0.5) / k;
+      break;
+    case WAVE_SQUARE:
+      harm[k][1] = k % 2 ? -0.5 / k : 0;
+      break;
+    }
+  }
+
+  wave_spectrum(W, harm, WAVE_HARMONICS);
+}
+
+//-------------------------------------
+// one cycle, the whole of the buffer
+void wave_init_buffer(wave_t *W, buffer_t *B, uint chan) {
+  ZERO(W, wave_t);
+
+  int len = B->len, num = MIN(len / 2 - 1, WAVE_HARMONICS);
+  if (!B->data || num < 1) {
+    printf("[wave error] buffer is too short for a wavetable\n");
+    wave_init(W, WAVE_SINE);
+    return;
+  }
+
+  double *cycle = fftw_alloc_real(len);
+  fftw_complex *harm = fftw_alloc_complex(len / 2 + 1);
+  fftw_plan plan = fftw_plan_dft_r2c_1d(len, cycle, harm, FFTW_ESTIMATE);
+
+  loop(i, len) cycle[i] = buffer_read1(B, i, MIN(chan, B->chans - 1));
+  fftw_execute(plan);
+  wave_spectrum(W, harm, num);
+
+  fftw_destroy_plan(plan);
+  fftw_free(cycle);
+  fftw_free(harm);
+}
+
+//-------------------------------------
+wave_t *wave_new(wave_type_t type) {
+  wave_t *W = MEM_NEW(wave_t);
+  wave_init(W, type);
+  return W;
+}
+
+//-------------------------------------
+void wave_destroy(wave_t *W) { MEM_FREE(W->data); }
+
+//-------------------------------------
+// phase in cycles, 0 <= phase < 1
+float wave_read(wave_t *W, int level, float phase) {
+  float *t = wave_table(W, level);
+  float x = phase * WAVE_SIZE;
+  int i = MIN((int)x, WAVE_SIZE - 1);
+  return t[i] + (x - i) * (t[i + 1] - t[i]);
+}
+
+// shared by every oscil_t that doesn't have a wave of its own
+wave_t wave_sine;
+
+//-------------------------------------
+// oscil
+//-------------------------------------
+typedef struct {
+  sample_t value;
+  wave_t *wave;
+  float freq, phase;
+} oscil_t;
+typedef oscil_t *oscil_p;
+void oscil_init(oscil_t *O);
+sample_t oscil_update(oscil_t *O);
+
+//-------------------------------------
+void wave_sine_fill() { wave_init(&wave_sine, WAVE_SINE); }
+pthread_once_t wave_sine_once = PTHREAD_ONCE_INIT;
+
+//-------------------------------------
+void oscil_init(oscil_t *O) {
+  ZERO(O, oscil_t);
+  O->freq = 440;
+
+  pthread_once(&wave_sine_once, wave_sine_fill);
+  O->wave = &wave_sine;
+}
+
+//-------------------------------------
+oscil_t *oscil_new() {
+  oscil_t *O = MEM_NEW(oscil_t);
+  oscil_init(O);
+  return O;
+}
+
+//-------------------------------------
+// phase is in cycles
+sample_t oscil_update(oscil_t *O) {
+  float inc = O->freq / audio.rate;
+
+  O->value.value[0] = O->value.value[1] =
+      wave_read(O->wave, wave_level(inc), O->phase);
+  O->phase += inc;
+  O->phase -= floorf(O->phase);
+
+  return O->value;
+}
+
+//-------------------------------------
+// bank
+//-------------------------------------
+// lots of oscillators reading one wave, summed into a mono block. freq, amp
+// and phase are arrays (one entry per oscillator) that can be written
+// directly between blocks. each oscillator picks its octave once per block
+typedef struct {
+  wave_t *wave;
+  float *freq, *amp, *phase;
+  int num;
+} bank_t;
+typedef bank_t *bank_p;
+void bank_init(bank_t *B, wave_t *wave, int num);
+bank_t *bank_new(wave_t *wave, int num);
+void bank_destroy(bank_t *B);
+
+//-------------------------------------
+void bank_init(bank_t *B, wave_t *wave, int num) {
+  ZERO(B, bank_t);
+
+  B->wave = wave, B->num = num;
+  B->freq = mem_calloc(3 * num, sizeof(float));
+  B->amp = B->freq + num;
+  B->phase = B->amp + num;
+}
+
+//-------------------------------------
+bank_t *bank_new(wave_t *wave, int num) {
+  bank_t *B = MEM_NEW(bank_t);
+  bank_init(B, wave, num);
+  return B;
+}
+
+//-------------------------------------
+void bank_destroy(bank_t *B) { MEM_FREE(B->freq); }
+
+//-------------------------------------
+// adds every oscillator into out
+void bank_render(bank_t *B, float *out, int n) {
+  float scale = 1 / audio.rate;
+
+  loop(o, B->num) {
+    float amp = B->amp[o], inc = B->freq[o] * scale, phase = B->phase[o];
+    if (amp == 0) {
+      phase += inc * n;
+      B->phase[o] = phase - floorf(phase);
+      continue;
+    }
+
+    const float *t = wave_table(B->wave, wave_level(inc));
+    int i = 0;
+#ifdef VEC_SIZE
+    vec_t A = vec_set1(amp), S = vec_set1(WAVE_SIZE);
+    vec_t step = vec_mul(vec_load(vec_ramp), vec_set1(inc));
+    block_loop(i, n) {
+      vec_t p = vec_add(vec_set1(phase), step);
+      p = vec_sub(p, vec_floor(p));
+      p = vec_min(vec_mul(p, S), vec_set1(WAVE_SIZE - 0.001));
+      vec_t y = vec_mul(A, vec_table(t, p));
+      vec_store(out + i, vec_add(vec_load(out + i), y));
+
+      phase += inc * VEC_SIZE;
+      phase -= floorf(phase);
+    }
+#endif
+    for (; i < n; ++i) {
+      float x = phase * WAVE_SIZE;
+      int j = MIN((int)x, WAVE_SIZE - 1);
+      out[i] += amp * (t[j] + (x - j) * (t[j + 1] - t[j]));
+      phase += inc;
+      phase -= floorf(phase);
+    }
+
+    B->phase[o] = phase;
+  }
+}
+
+//-------------------------------------
+// a generator: in is ignored, both channels get the same sum
+void bank_process(bank_t *B, const float *in[2], float *out[2], int frames) {
+  memset(out[0], 0, frames * sizeof(float));
+  bank_render(B, out[0], frames);
+  memcpy(out[1], out[0], frames * sizeof(float));
+}
+
 //-------------------------------------
 // fft
 //-------------------------------------
@@ -433,27 +2266,32 @@ typedef struct {
   fftw_plan r2c[2], c2r[2];
   double *in[2];
   fftw_complex *out[2];
-  int pos;
+  int pos, size;
 } fft_t;
 typedef fft_t *fft_p;
 
 #define fft_loop for (int f = 0; f < FFT_HALF_SIZE; ++f)
 
 //-------------------------------------
-void fft_init(fft_t *F) {
+// any size, size / 2 + 1 bins come out. planning isn't realtime safe
+void fft_init_size(fft_t *F, int size) {
   ZERO(F, fft_t);
 
+  F->size = size;
   sample_loop {
-    F->in[c] = fftw_alloc_real(FFT_SIZE);
-    F->out[c] = fftw_alloc_complex(FFT_HALF_SIZE);
-    F->r2c[c] = fftw_plan_dft_r2c_1d(FFT_SIZE, F->in[c], F->out[c], 0);
-    F->c2r[c] = fftw_plan_dft_c2r_1d(FFT_SIZE, F->out[c], F->in[c], 0);
+    F->in[c] = fftw_alloc_real(size);
+    F->out[c] = fftw_alloc_complex(size / 2 + 1);
+    F->r2c[c] = fftw_plan_dft_r2c_1d(size, F->in[c], F->out[c], 0);
+    F->c2r[c] = fftw_plan_dft_c2r_1d(size, F->out[c], F->in[c], 0);
   }
 }
 
+//-------------------------------------
+void fft_init(fft_t *F) { fft_init_size(F, FFT_SIZE); }
+
 //-------------------------------------
 fft_t *fft_new() {
-  fft_t *F = NEW(fft_t);
+  fft_t *F = MEM_NEW(fft_t);
   fft_init(F);
   return F;
 }
@@ -493,35 +2331,184 @@ void fft_c2r(fft_t *F) {
 }
 
 //-------------------------------------
-void fft_destroy(fft_t *F) {
-  sample_loop {
-    fftw_free(F->in[c]);
-    fftw_free(F->out[c]);
-    fftw_destroy_plan(F->r2c[c]);
-    fftw_destroy_plan(F->c2r[c]);
+void fft_destroy(fft_t *F) {
+  sample_loop {
+    fftw_free(F->in[c]);
+    fftw_free(F->out[c]);
+    fftw_destroy_plan(F->r2c[c]);
+    fftw_destroy_plan(F->c2r[c]);
+  }
+}
+
+//-------------------------------------
+carte_t fft_read(fft_t *F, int pos, uint chan) {
+  return make_carte(F->out[chan][pos][0], F->out[chan][pos][1]);
+}
+
+//-------------------------------------
+void fft_write(fft_t *F, int pos, uint chan, carte_t in) {
+  F->out[chan][pos][0] = in.x, F->out[chan][pos][1] = in.y;
+}
+
+//-------------------------------------
+void fft_play(fft_t *F) {
+  fft_loop {
+    int I = audio.pos - FFT_SIZE + f;
+    while (I < 0)
+      I += audio.frames;
+    while (I >= audio.frames)
+      I -= audio.frames;
+
+    sample_loop bus_out(c)[I] += F->in[c][f] / FFT_SIZE;
+  }
+}
+
+//-------------------------------------
+// additive
+//-------------------------------------
+// sinusoids written straight into an fft_t spectrum instead of being run one
+// sample at a time. every hop each partial adds the few bins around its
+// frequency that a hann windowed sinusoid would have, one c2r turns all of
+// them into a frame, and the frames are overlap-added. so the cost per
+// partial is a handful of bins per hop, not a sin() per sample. freq (hz),
+// amp, and pan (0 left, 1 right) can be written between blocks; the output
+// is one frame (FFT_SIZE) late
+#define ADDITIVE_HOP (FFT_SIZE / 4)
+#define ADDITIVE_LOBE 4
+#define ADDITIVE_OVERSAMPLE 32
+#define ADDITIVE_KERNEL (2 * ADDITIVE_LOBE * ADDITIVE_OVERSAMPLE + 2)
+
+typedef struct {
+  fft_t fft;
+  float *freq, *amp, *pan, *phase;
+  int num, read;
+  float ola[2][FFT_SIZE];
+} additive_t;
+typedef additive_t *additive_p;
+void additive_init(additive_t *A, int num);
+additive_t *additive_new(int num);
+void additive_destroy(additive_t *A);
+
+// the spectrum of a hann window around one bin, in steps of
+// 1 / ADDITIVE_OVERSAMPLE bins from -ADDITIVE_LOBE
+float additive_kernel[ADDITIVE_KERNEL];
+
+//-------------------------------------
+float additive_sinc(float x) { return x == 0 ? 1 : sinf(PI * x) / (PI * x); }
+
+//-------------------------------------
+void additive_fill() {
+  loop(i, ADDITIVE_KERNEL) {
+    float d = (float)i / ADDITIVE_OVERSAMPLE - ADDITIVE_LOBE;
+    additive_kernel[i] = 0.5 * additive_sinc(d) + 0.25 * additive_sinc(d - 1) +
+                         0.25 * additive_sinc(d + 1);
+  }
+}
+pthread_once_t additive_once = PTHREAD_ONCE_INIT;
+
+//-------------------------------------
+void additive_init(additive_t *A, int num) {
+  ZERO(A, additive_t);
+  fft_init(&A->fft);
+
+  pthread_once(&additive_once, additive_fill);
+
+  A->num = num;
+  A->freq = mem_calloc(4 * num, sizeof(float));
+  A->amp = A->freq + num;
+  A->pan = A->amp + num;
+  A->phase = A->pan + num;
+  loop(p, num) A->pan[p] = 0.5;
+
+  A->read = ADDITIVE_HOP;
+}
+
+//-------------------------------------
+additive_t *additive_new(int num) {
+  additive_t *A = MEM_NEW(additive_t);
+  additive_init(A, num);
+  return A;
+}
+
+//-------------------------------------
+void additive_destroy(additive_t *A) {
+  fft_destroy(&A->fft);
+  MEM_FREE(A->freq);
+}
+
+//-------------------------------------
+// adds (re, im) * kernel(k - bin) * gain[c] to every bin k in reach. the
+// frame is centred on FFT_SIZE / 2, which flips the sign of every other bin
+void additive_splat(fftw_complex *out[2], float bin, float re, float im,
+                    const float gain[2]) {
+  int lo = MAX(ceilf(bin - ADDITIVE_LOBE), 0);
+  // not the nyquist bin, c2r throws its imaginary part away
+  int hi = MIN(floorf(bin + ADDITIVE_LOBE), FFT_HALF_SIZE - 2);
+
+  for (int k = lo; k <= hi; ++k) {
+    float x = (k - bin + ADDITIVE_LOBE) * ADDITIVE_OVERSAMPLE;
+    int i = x;
+    float w = additive_kernel[i] +
+              (x - i) * (additive_kernel[i + 1] - additive_kernel[i]);
+    if (k & 1)
+      w = -w;
+    sample_loop {
+      out[c][k][0] += re * w * gain[c], out[c][k][1] += im * w * gain[c];
+    }
+  }
+}
+
+//-------------------------------------
+void additive_frame(additive_t *A) {
+  fft_t *F = &A->fft;
+  float bins = FFT_SIZE / audio.rate;
+
+  sample_loop memset(F->out[c], 0, FFT_HALF_SIZE * sizeof(fftw_complex));
+
+  loop(p, A->num) {
+    float amp = A->amp[p], bin = A->freq[p] * bins;
+    float phase = A->phase[p];
+
+    // phase is at the centre of the frame
+    A->phase[p] = fmodf(phase + TAU * bin * ADDITIVE_HOP / FFT_SIZE, TAU);
+
+    if (amp == 0 || bin <= 0 || bin >= FFT_HALF_SIZE - 1)
+      continue;
+
+    float re = cosf(phase) * amp * 0.5, im = sinf(phase) * amp * 0.5;
+    float gain[2] = {sqrtf(1 - A->pan[p]), sqrtf(A->pan[p])};
+
+    additive_splat(F->out, bin, re, im, gain);
+    // the negative frequency side, for partials near dc
+    if (bin < ADDITIVE_LOBE)
+      additive_splat(F->out, -bin, re, -im, gain);
   }
-}
 
-//-------------------------------------
-carte_t fft_read(fft_t *F, int pos, uint chan) {
-  return make_carte(F->out[chan][pos][0], F->out[chan][pos][1]);
-}
+  fft_c2r(F);
 
-//-------------------------------------
-void fft_write(fft_t *F, int pos, uint chan, carte_t in) {
-  F->out[chan][pos][0] = in.x, F->out[chan][pos][1] = in.y;
+  // hann frames at a quarter overlap add up to 2
+  sample_loop {
+    memmove(A->ola[c], A->ola[c] + ADDITIVE_HOP,
+            (FFT_SIZE - ADDITIVE_HOP) * sizeof(float));
+    memset(A->ola[c] + FFT_SIZE - ADDITIVE_HOP, 0,
+           ADDITIVE_HOP * sizeof(float));
+    loop(i, FFT_SIZE) A->ola[c][i] += F->in[c][i] * 0.5;
+  }
 }
 
 //-------------------------------------
-void fft_play(fft_t *F) {
-  fft_loop {
-    int I = audio.pos - FFT_SIZE + f;
-    while (I < 0)
-      I += audio.frames;
-    while (I >= audio.frames)
-      I -= audio.frames;
+// a generator: in is ignored
+void additive_process(additive_t *A, const float *in[2], float *out[2],
+                      int frames) {
+  for (int i = 0; i < frames;) {
+    if (A->read >= ADDITIVE_HOP) {
+      additive_frame(A);
+      A->read = 0;
+    }
 
-    sample_loop audio.buf_out[c][I] += F->in[c][f] / FFT_SIZE;
+    int n = MIN(frames - i, ADDITIVE_HOP - A->read);
+    sample_loop memcpy(out[c] + i, A->ola[c] + A->read, n * sizeof(float));
+    A->read += n, i += n;
   }
 }
 
@@ -539,7 +2526,7 @@ void recorder_init(recorder_t *R) { ZERO(R, recorder_t); }
 
 //-------------------------------------
 recorder_t *recorder_new() {
-  recorder_t *R = NEW(recorder_t);
+  recorder_t *R = MEM_NEW(recorder_t);
   recorder_init(R);
   return R;
 }
@@ -564,6 +2551,7 @@ typedef struct {
   int write;
   float dur, read, speed;
   bool record;
+  buffer_interp_t interp;
   sample_t value;
 } looper_t;
 typedef looper_t *looper_p;
@@ -577,11 +2565,12 @@ void looper_init(looper_t *L, int len) {
   L->dur = 1;
   L->speed = 1;
   L->record = true;
+  L->interp = BUFFER_CUBIC;
 }
 
 //-------------------------------------
 looper_t *looper_new(int len) {
-  looper_t *L = NEW(looper_t);
+  looper_t *L = MEM_NEW(looper_t);
   looper_init(L, len);
   return L;
 }
@@ -607,12 +2596,70 @@ sample_t looper_update(looper_t *L, sample_t in) {
     else if (L->read < 0)
       L->read = (L->buf.len - 1) * L->dur;
 
-    L->value = buffer_read(&L->buf, floorf(L->read));
+    sample_loop L->value.value[c] =
+        buffer_interp(&L->buf, L->read, c, L->interp, 0);
 
     return L->value;
   }
 }
 
+//-------------------------------------
+void looper_process(looper_t *L, const float *in[2], float *out[2],
+                    int frames) {
+  float *data = L->buf.data;
+  int len = L->buf.len;
+
+  if (frames <= 0)
+    return;
+
+  if (!data) {
+    sample_loop if (out[c] != in[c])
+        memcpy(out[c], in[c], frames * sizeof(float));
+    return;
+  }
+
+  if (L->record) {
+    int write = L->write;
+    for (int i = 0; i < frames; ++i) {
+      sample_loop {
+        data[write * 2 + c] = in[c][i];
+        out[c][i] = in[c][i];
+      }
+
+      if (++write >= len)
+        write = 0;
+    }
+    L->write = write;
+  } else {
+    float read = L->read, speed = L->speed, limit = len * L->dur;
+    for (int i = 0; i < frames;) {
+      // a span up to the wrap, then the wrap on its own
+      int n = frames - i;
+      if (speed > 0)
+        n = MIN(n, (int)ceilf((limit - read) / speed) - 1);
+      else if (speed < 0)
+        n = MIN(n, (int)floorf(read / -speed));
+
+      if (n <= 0) {
+        read += speed;
+        if (read >= limit)
+          read = 0;
+        else if (read < 0)
+          read = (len - 1) * L->dur;
+        n = 1;
+      } else
+        read += speed * n;
+
+      float *o[2] = {out[0] + i, out[1] + i};
+      buffer_span(&L->buf, o, read - speed * (n - 1), speed, n, L->interp);
+      i += n;
+    }
+    L->read = read;
+  }
+
+  sample_loop L->value.value[c] = out[c][frames - 1];
+}
+
 //-------------------------------------
 void looper_set(looper_t *L, bool record) {
   if (record == L->record)
@@ -646,7 +2693,7 @@ void metro_init(metro_t *M) {
 
 //-------------------------------------
 metro_t *metro_new() {
-  metro_t *M = malloc(sizeof(metro_t));
+  metro_t *M = MEM_NEW(metro_t);
   metro_init(M);
   return M;
 }
@@ -682,12 +2729,18 @@ int metro_update_block(metro_t *M) {
 //-------------------------------------
 // sampler
 //-------------------------------------
+// with a stream instead of a buffer (sampler_stream) it plays from disk:
+// triggering and looping seek the stream, so start points past its head
+// are silent until the read-ahead catches up, and it should play forward
 typedef struct {
   sample_t value;
   buffer_t *buf;
+  stream_t *stream;
   bool forward;
   bool loop, active;
-  float start, end, rate, pos;
+  float start, end, rate;
+  double pos;
+  buffer_interp_t interp;
 } sampler_t;
 typedef sampler_t *sampler_p;
 
@@ -697,11 +2750,12 @@ void sampler_init(sampler_t *S) {
   S->rate = 1, S->forward = 1;
   S->start = 0, S->end = 1;
   S->loop = true, S->active = false;
+  S->interp = BUFFER_CUBIC;
 }
 
 //-------------------------------------
 sampler_t *sampler_new() {
-  sampler_t *S = malloc(sizeof(sampler_t));
+  sampler_t *S = MEM_NEW(sampler_t);
   sampler_init(S);
   return S;
 }
@@ -720,42 +2774,274 @@ void sampler_dur(sampler_t *S, float start, float dur) {
 }
 
 //-------------------------------------
-void sampler_set(sampler_t *S, buffer_t *B) { S->buf = B; }
+void sampler_set(sampler_t *S, buffer_t *B) { S->buf = B, S->stream = NULL; }
+void sampler_stream(sampler_t *S, stream_t *T) { S->stream = T, S->buf = NULL; }
+
+//-------------------------------------
+uint sampler_len(sampler_t *S) {
+  return S->stream ? S->stream->len : S->buf ? S->buf->len : 0;
+}
 
 //-------------------------------------
+// from the audio thread when streaming
 void sampler_trigger(sampler_t *S) {
-  if (!S->buf)
+  if (!sampler_len(S))
     return;
 
-  S->pos = (S->forward ? S->start : S->end) * (S->buf->len - 1);
+  S->pos = (double)(S->forward ? S->start : S->end) * (sampler_len(S) - 1);
   S->active = true;
+  if (S->stream)
+    stream_seek(S->stream, floor(S->pos) - STREAM_GUARD);
+}
+
+//-------------------------------------
+void sampler_process(sampler_t *S, const float *in[2], float *out[2],
+                     int frames) {
+  buffer_t *B = S->buf;
+  stream_t *T = S->stream;
+  uint len = sampler_len(S);
+  int i = 0;
+
+  if (((B && B->data) || T) && len && S->active) {
+    double pos = S->pos;
+    double step = (S->forward ? 1 : -1) *
+                  buffer_rate_scale(T ? &T->head : B, S->rate);
+    double start = (double)S->start * (len - 1);
+    double end = (double)S->end * (len - 1);
+    bool active = true;
+
+    while (i < frames && active) {
+      // every frame up to the end of the range in one span
+      double left = S->forward ? end - pos : pos - start;
+      int n = frames - i;
+      if (step != 0)
+        n = MIN(n, (int)floor(MAX(left, 0) / fabs(step)) + 1);
+
+      float *o[2] = {out[0] + i, out[1] + i};
+      if (T)
+        stream_span(T, o, pos, step, n, S->interp);
+      else
+        buffer_span(B, o, pos, step, n, S->interp);
+      pos += step * n, i += n;
+
+      if (S->forward ? pos > end : pos < start) {
+        if (S->loop) {
+          pos = S->forward ? start : end;
+          if (T)
+            stream_seek(T, floor(pos) - STREAM_GUARD);
+        } else
+          active = false;
+      }
+    }
+
+    S->pos = pos, S->active = active;
+    if (i > 0)
+      S->value = make_sample(out[0][i - 1], out[1][i - 1]);
+  }
+
+  if (i < frames)
+    sample_loop memset(out[c] + i, 0, (frames - i) * sizeof(float));
 }
 
 //-------------------------------------
 sample_t sampler_update(sampler_t *S) {
-  if (!S->buf || !S->active)
-    return sample_zero;
+  float l, r, *out[2] = {&l, &r};
+  sampler_process(S, NULL, out, 1);
+  return make_sample(l, r);
+}
 
-  int ipos = CLIP((int)floorf(S->pos), 0, S->buf->len - 1);
-  S->value = buffer_read(S->buf, ipos);
+//-------------------------------------
+// voices
+//-------------------------------------
+// a pool of one-shot sampler voices, kept as arrays (one entry per voice)
+// rather than an array of sampler_t. voices_play starts a voice partway
+// into the next block; once more than size are sounding, the oldest (or
+// quietest) one is stolen and faded out over VOICES_FADE frames instead of
+// cut. order keeps the sounding voices first, so a block only visits
+// those. rate scales the speed of every voice
+#define VOICES_MAX 256
+#define VOICES_FADE 64
+#define VOICES_MAX_FRAMES 256
+#define VOICES_SILENT 1e-4
+
+typedef enum { VOICES_OLDEST, VOICES_QUIETEST } voices_steal_t;
 
-  S->pos += (S->forward ? 1 : -1) * buffer_rate_scale(S->buf, S->rate);
+typedef struct {
+  // twice VOICES_MAX, so stolen voices can fade out beside their
+  // replacements
+  buffer_t *buf[VOICES_MAX * 2];
+  float pos[VOICES_MAX * 2], step[VOICES_MAX * 2];
+  float gain[2][VOICES_MAX * 2];
+  float env[VOICES_MAX * 2], mul[VOICES_MAX * 2], fade[VOICES_MAX * 2];
+  uint age[VOICES_MAX * 2];
+  int onset[VOICES_MAX * 2];
+
+  // sounding voices first, then the free ones
+  int order[VOICES_MAX * 2], num, live;
+
+  int size;
+  voices_steal_t steal;
+  buffer_interp_t interp;
+  float rate, decay;
+  uint count;
+  float tmp[2][VOICES_MAX_FRAMES];
+  sample_t value;
+} voices_t;
+typedef voices_t *voices_p;
+void voices_init(voices_t *V, int size);
+voices_t *voices_new(int size);
 
-  float start = S->start * (S->buf->len - 1);
-  float end = S->end * (S->buf->len - 1);
-  if (S->forward && S->pos > end) {
-    if (S->loop)
-      S->pos = start;
-    else
-      S->active = false;
-  } else if (!S->forward && S->pos < start) {
-    if (S->loop)
-      S->pos = end;
-    else
-      S->active = false;
+//-------------------------------------
+// size voices can sound at once, not counting the ones fading out
+void voices_init(voices_t *V, int size) {
+  ZERO(V, voices_t);
+
+  V->size = CLIP(size, 1, VOICES_MAX);
+  V->rate = 1;
+  loop(v, VOICES_MAX * 2) V->order[v] = v;
+}
+
+//-------------------------------------
+voices_t *voices_new(int size) {
+  voices_t *V = MEM_NEW(voices_t);
+  voices_init(V, size);
+  return V;
+}
+
+//-------------------------------------
+// the voice to make room with, among the ones not already fading
+int voices_victim(voices_t *V) {
+  int best = -1;
+  float best_score = 0;
+
+  loop(o, V->num) {
+    int v = V->order[o];
+    if (V->fade[v] > 0)
+      continue;
+
+    float score = V->steal == VOICES_QUIETEST
+                      ? V->env[v] * MAX(V->gain[0][v], V->gain[1][v])
+                      : (float)(V->count - V->age[v]);
+    if (best < 0 || (V->steal == VOICES_QUIETEST ? score < best_score
+                                                 : score > best_score))
+      best = v, best_score = score;
+  }
+
+  return best;
+}
+
+//-------------------------------------
+void voices_stop(voices_t *V, int v) {
+  if (V->fade[v] > 0)
+    return;
+  V->fade[v] = MAX(V->env[v], VOICES_SILENT) / VOICES_FADE;
+  V->live--;
+}
+
+//-------------------------------------
+// starts B at onset frames into the next block, pan from -1 to 1. returns
+// the voice, or -1 when even the fading ones fill the pool
+int voices_play(voices_t *V, buffer_t *B, int onset, float rate, float gain,
+                float pan) {
+  if (!B || !B->data)
+    return -1;
+
+  if (V->live >= V->size) {
+    int victim = voices_victim(V);
+    if (victim >= 0)
+      voices_stop(V, victim);
+  }
+  if (V->num >= VOICES_MAX * 2)
+    return -1;
+
+  int v = V->order[V->num++];
+  V->live++;
+
+  V->buf[v] = B;
+  V->pos[v] = 0;
+  V->step[v] = buffer_rate_scale(B, rate);
+  V->onset[v] = MAX(onset, 0);
+  V->age[v] = V->count++;
+
+  // equal power
+  float p = (CLIP(pan, -1, 1) + 1) * PI / 4;
+  V->gain[0][v] = gain * cosf(p), V->gain[1][v] = gain * sinf(p);
+
+  V->env[v] = 1, V->fade[v] = 0;
+  V->mul[v] = V->decay > 0 ? expf(-1 / (V->decay * audio.rate)) : 1;
+
+  return v;
+}
+
+//-------------------------------------
+// up to n frames of voice v into tmp, returns how many. the voice is done
+// once it runs off the end of its buffer or goes quiet
+int voices_render(voices_t *V, int v, int n, bool *done) {
+  buffer_t *B = V->buf[v];
+  int last = B->len - 1;
+  float pos = V->pos[v], step = V->step[v] * V->rate;
+  float env = V->env[v], mul = V->mul[v], fade = V->fade[v];
+
+  // up to either end of the buffer, or until it has faded out. a voice
+  // that isn't moving would hold one frame forever, so it stops at once
+  if (step > 0)
+    n = MIN(n, (int)ceilf((last - pos) / step));
+  else if (step < 0)
+    n = MIN(n, (int)ceilf(pos / -step));
+  else
+    n = 0;
+  n = MAX(n, 0);
+
+  float *tmp[2] = {V->tmp[0], V->tmp[1]};
+  buffer_span(B, tmp, pos, step, n, V->interp);
+
+  int i = 0;
+  for (; i < n && env >= VOICES_SILENT; ++i) {
+    sample_loop V->tmp[c][i] *= env;
+    env = env * mul - fade;
+  }
+
+  pos += step * i;
+  V->pos[v] = pos, V->env[v] = env;
+  bool end = step > 0 ? pos >= last : step < 0 ? pos <= 0 : true;
+  *done = end || env < VOICES_SILENT;
+  return i;
+}
+
+//-------------------------------------
+void voices_process(voices_t *V, const float *in[2], float *out[2],
+                    int frames) {
+  sample_loop memset(out[c], 0, MAX(frames, 0) * sizeof(float));
+
+  for (int offset = 0; offset < frames; offset += VOICES_MAX_FRAMES) {
+    int n = MIN(frames - offset, VOICES_MAX_FRAMES);
+
+    for (int o = 0; o < V->num;) {
+      int v = V->order[o], onset = MIN(V->onset[v], n);
+      bool done;
+      int len = voices_render(V, v, n - onset, &done);
+      V->onset[v] -= onset;
+
+      sample_loop {
+        float *x = out[c] + offset + onset;
+        block_lincomb(x, x, 1, V->tmp[c], V->gain[c][v], len);
+      }
+
+      if (!done) {
+        o++;
+        continue;
+      }
+
+      // swap it behind the sounding ones
+      if (V->fade[v] == 0)
+        V->live--;
+      V->order[o] = V->order[--V->num];
+      V->order[V->num] = v;
+    }
   }
 
-  return S->value;
+  if (frames > 0)
+    V->value = make_sample(out[0][frames - 1], out[1][frames - 1]);
 }
 
 //-------------------------------------
@@ -782,7 +3068,7 @@ void delay_init(delay_t *D, int len) {
 
 //-------------------------------------
 delay_t *delay_new(int len) {
-  delay_t *D = NEW(delay_t);
+  delay_t *D = MEM_NEW(delay_t);
   delay_init(D, len);
   return D;
 }
@@ -805,6 +3091,35 @@ sample_t delay_update(delay_t *D, sample_t in) {
   return D->value;
 }
 
+//-------------------------------------
+void delay_process(delay_t *D, const float *in[2], float *out[2], int frames) {
+  float *data = D->buf.data;
+  int len = D->buf.len;
+
+  if (!data || frames <= 0)
+    return;
+
+  int pos = D->pos;
+  int read = ((pos - sec2samp(D->del)) % len + len) % len;
+  float mix = D->mix;
+
+  for (int i = 0; i < frames; ++i) {
+    sample_loop {
+      float x = in[c][i], y = data[read * 2 + c];
+      data[pos * 2 + c] = x * mix + y * (1 - mix);
+      out[c][i] = y;
+    }
+
+    if (++pos >= len)
+      pos = 0;
+    if (++read >= len)
+      read = 0;
+  }
+
+  D->pos = pos;
+  sample_loop D->value.value[c] = out[c][frames - 1];
+}
+
 //-------------------------------------
 // delay
 //-------------------------------------
@@ -827,7 +3142,7 @@ void comb_init(comb_t *C) {
 
 //-------------------------------------
 comb_t *comb_new() {
-  comb_t *C = NEW(comb_t);
+  comb_t *C = MEM_NEW(comb_t);
   comb_init(C);
   return C;
 }
@@ -842,39 +3157,566 @@ sample_t comb_update(comb_t *C, sample_t in) {
   C->value = sample_add(in, buffer_read(&C->buf, read));
   buffer_write(&C->buf, C->pos, in);
 
-  C->pos++;
-  if (C->pos >= C->buf.len)
-    C->pos = 0;
+  C->pos++;
+  if (C->pos >= C->buf.len)
+    C->pos = 0;
+
+  return C->value;
+}
+
+//-------------------------------------
+void comb_process(comb_t *C, const float *in[2], float *out[2], int frames) {
+  float *data = C->buf.data;
+  int len = C->buf.len;
+
+  if (!data || frames <= 0)
+    return;
+
+  int pos = C->pos;
+  int read = ((pos - sec2samp(C->del * COMB_MAX)) % len + len) % len;
+
+  for (int i = 0; i < frames; ++i) {
+    sample_loop {
+      float x = in[c][i];
+      out[c][i] = x + data[read * 2 + c];
+      data[pos * 2 + c] = x;
+    }
+
+    if (++pos >= len)
+      pos = 0;
+    if (++read >= len)
+      read = 0;
+  }
+
+  C->pos = pos;
+  sample_loop C->value.value[c] = out[c][frames - 1];
+}
+
+//-------------------------------------
+// taps
+//-------------------------------------
+// a stereo delay line with up to TAPS_MAX taps, each with its own time, gain
+// into either output and a 2x2 feedback matrix back into the line (so taps
+// can ping-pong). reads are fractional (linear, cubic or allpass) and a tap's
+// time glides to its new value across each block, so it can be modulated for
+// chorus and flanging. the line has a few guard frames on either side, so a
+// block is read and written as at most two contiguous spans. blocks are
+// split so no tap reads frames that aren't written yet
+#define TAPS_MAX 64
+#define TAPS_MAX_FRAMES 256
+#define TAPS_GUARD 4
+#define TAPS_MIN_DELAY 4
+
+typedef enum { TAPS_LINEAR, TAPS_CUBIC, TAPS_ALLPASS } taps_interp_t;
+
+typedef struct {
+  float time, gain[2];
+  float fb[2][2]; // [from][to]
+
+  float cur, step; // in frames
+  float ap[2];     // last allpass output
+} tap_t;
+
+typedef struct {
+  tap_t tap[TAPS_MAX];
+  int num;
+  taps_interp_t interp;
+  float dry, wet;
+
+  float *line[2];
+  int len, mask, pos;
+  float *work[2], *fb[2], *wet_buf[2], *data;
+} taps_t;
+typedef taps_t *taps_p;
+void taps_init(taps_t *T, int len);
+taps_t *taps_new(int len);
+void taps_destroy(taps_t *T);
+
+//-------------------------------------
+// len is the longest delay in frames
+void taps_init(taps_t *T, int len) {
+  ZERO(T, taps_t);
+
+  T->len = 1;
+  while (T->len < len + TAPS_MAX_FRAMES + 2 * TAPS_GUARD)
+    T->len <<= 1;
+  T->mask = T->len - 1;
+
+  int line = T->len + 2 * TAPS_GUARD;
+  T->data = mem_calloc(2 * line + 6 * TAPS_MAX_FRAMES, sizeof(float));
+
+  float *work = T->data + 2 * line;
+  sample_loop {
+    T->line[c] = T->data + c * line + TAPS_GUARD;
+    T->work[c] = work + c * TAPS_MAX_FRAMES;
+    T->fb[c] = work + (2 + c) * TAPS_MAX_FRAMES;
+    T->wet_buf[c] = work + (4 + c) * TAPS_MAX_FRAMES;
+  }
+
+  T->dry = 1, T->wet = 1;
+}
+
+//-------------------------------------
+taps_t *taps_new(int len) {
+  taps_t *T = MEM_NEW(taps_t);
+  taps_init(T, len);
+  return T;
+}
+
+//-------------------------------------
+void taps_destroy(taps_t *T) { MEM_FREE(T->data); }
+
+//-------------------------------------
+float taps_clip(taps_t *T, float time) {
+  return CLIP(time * audio.rate, TAPS_MIN_DELAY,
+              T->len - TAPS_MAX_FRAMES - 2 * TAPS_GUARD);
+}
+
+//-------------------------------------
+// returns the tap's index, or -1 when they're all in use. time is in seconds
+int taps_add(taps_t *T, float time, float gain, float fb) {
+  if (T->num >= TAPS_MAX) {
+    printf("[taps error] no more than %i taps\n", TAPS_MAX);
+    return -1;
+  }
+
+  tap_t *P = &T->tap[T->num];
+  ZERO(P, tap_t);
+  P->time = time;
+  P->cur = taps_clip(T, time);
+  sample_loop P->gain[c] = gain, P->fb[c][c] = fb;
+
+  return T->num++;
+}
+
+//-------------------------------------
+void taps_clear(taps_t *T) {
+  sample_loop memset(T->line[c] - TAPS_GUARD, 0,
+                     (T->len + 2 * TAPS_GUARD) * sizeof(float));
+  loop(t, T->num) sample_loop T->tap[t].ap[c] = 0;
+}
+
+//-------------------------------------
+// 4 point hermite weights for frames k-1 .. k+2
+void taps_cubic(float h[4], float f) {
+  float f2 = f * f, f3 = f2 * f;
+  h[0] = -0.5 * f + f2 - 0.5 * f3;
+  h[1] = 1 - 2.5 * f2 + 1.5 * f3;
+  h[2] = 0.5 * f + 2 * f2 - 1.5 * f3;
+  h[3] = -0.5 * f2 + 0.5 * f3;
+}
+
+//-------------------------------------
+// one frame between x[k] and x[k + 1]. the allpass delays the stream by
+// 1 - f (or 2 - f, to keep its pole away from -1) and keeps its last output
+// in ap
+float taps_read(const float *x, int k, float f, taps_interp_t interp,
+                float *ap) {
+  switch (interp) {
+  case TAPS_CUBIC: {
+    float h[4];
+    taps_cubic(h, f);
+    return h[0] * x[k - 1] + h[1] * x[k] + h[2] * x[k + 1] + h[3] * x[k + 2];
+  }
+
+  case TAPS_ALLPASS: {
+    int j = f > 0.5 ? k + 2 : k + 1;
+    float d = f > 0.5 ? 2 - f : 1 - f;
+    float eta = (1 - d) / (1 + d);
+    *ap = eta * (x[j] - *ap) + x[j - 1];
+    return *ap;
+  }
+
+  default:
+    return x[k] + f * (x[k + 1] - x[k]);
+  }
+}
+
+//-------------------------------------
+// n frames of one tap and channel, starting at the line's write position
+void taps_span(taps_t *T, tap_t *P, uint c, float *out, int n) {
+  const float *x = T->line[c];
+
+  // a fixed time reads straight through the line, split once where it wraps
+  if (P->step == 0 && T->interp != TAPS_ALLPASS) {
+    int whole = floorf(P->cur), k = (T->pos - whole - 1) & T->mask;
+    float f = 1 - (P->cur - whole), h[4];
+    int taps = T->interp == TAPS_CUBIC ? 4 : 2;
+
+    if (taps == 4)
+      taps_cubic(h, f);
+    else
+      h[0] = 1 - f, h[1] = f;
+
+    for (int i = 0; i < n;) {
+      int span = MIN(n - i, T->len - k);
+      block_fir(out + i, x + k - (taps == 4), h, taps, span);
+      i += span, k = 0;
+    }
+    return;
+  }
+
+  float del = P->cur;
+  loop(i, n) {
+    int whole = (int)del;
+    int k = (T->pos + i - whole - 1) & T->mask;
+    out[i] = taps_read(x, k, 1 - (del - whole), T->interp, &P->ap[c]);
+    del += P->step;
+  }
+}
+
+//-------------------------------------
+// in[c] + fb[c] into the line, then the guard frames are refreshed
+void taps_write(taps_t *T, const float *in[2], int offset, int n) {
+  sample_loop {
+    float *x = T->line[c];
+    for (int i = 0, k = T->pos; i < n;) {
+      int span = MIN(n - i, T->len - k);
+      block_add(x + k, in[c] + offset + i, T->fb[c] + i, span);
+      i += span, k = 0;
+    }
+
+    memcpy(x - TAPS_GUARD, x + T->len - TAPS_GUARD, TAPS_GUARD * sizeof(float));
+    memcpy(x + T->len, x, TAPS_GUARD * sizeof(float));
+  }
+  T->pos = (T->pos + n) & T->mask;
+}
+
+//-------------------------------------
+void taps_process(taps_t *T, const float *in[2], float *out[2], int frames) {
+  if (!T->data || frames <= 0)
+    return;
+
+  // every tap glides to its time over this block. no piece may be longer
+  // than the shortest delay it passes through
+  float shortest = T->len;
+  loop(t, T->num) {
+    tap_t *P = &T->tap[t];
+    float target = taps_clip(T, P->time);
+    P->step = (target - P->cur) / frames;
+    shortest = MIN(shortest, MIN(P->cur, target));
+  }
+  int piece = CLIP((int)shortest - 3, 1, TAPS_MAX_FRAMES);
+
+  for (int offset = 0; offset < frames; offset += piece) {
+    int n = MIN(frames - offset, piece);
+
+    sample_loop {
+      memset(T->fb[c], 0, n * sizeof(float));
+      memset(T->wet_buf[c], 0, n * sizeof(float));
+    }
+
+    loop(t, T->num) {
+      tap_t *P = &T->tap[t];
+      sample_loop taps_span(T, P, c, T->work[c], n);
+
+      sample_loop {
+        if (P->gain[c] != 0)
+          block_lincomb(T->wet_buf[c], T->wet_buf[c], 1, T->work[c],
+                        P->gain[c], n);
+        loop(to, 2) {
+          if (P->fb[c][to] != 0)
+            block_lincomb(T->fb[to], T->fb[to], 1, T->work[c], P->fb[c][to],
+                          n);
+        }
+      }
+      P->cur += P->step * n;
+    }
+
+    taps_write(T, in, offset, n);
+
+    sample_loop block_lincomb(out[c] + offset, in[c] + offset, T->dry,
+                              T->wet_buf[c], T->wet, n);
+  }
+
+  // no drift from the steps
+  loop(t, T->num) {
+    T->tap[t].cur = taps_clip(T, T->tap[t].time);
+    T->tap[t].step = 0;
+  }
+}
+
+//-------------------------------------
+// reverb
+//-------------------------------------
+// a feedback delay network: 8 or 16 delay lines (the cpu/quality knob),
+// each with a one-pole lowpass for damping, mixed back into each other by a
+// hadamard or householder matrix. the shortest line is longer than a block
+// piece, so each piece is read from every line at once, and the mixing runs
+// along time with block_* calls instead of once per frame. line lengths are
+// slowly modulated to keep the tail from ringing
+#define REVERB_MAX_LINES 16
+#define REVERB_MAX_FRAMES 256
+#define REVERB_SHORTEST 0.0297
+#define REVERB_LONGEST 0.0931
+#define REVERB_MOD_RATE 0.7
+#define REVERB_GUARD 2
+
+typedef enum { REVERB_HADAMARD, REVERB_HOUSEHOLDER } reverb_matrix_t;
+
+typedef struct {
+  int lines;
+  reverb_matrix_t matrix;
+  float time, size, damp, mod, mix; // time is the rt60 in seconds, mod in ms
+
+  float *line[REVERB_MAX_LINES], *y[REVERB_MAX_LINES];
+  float base[REVERB_MAX_LINES], cur[REVERB_MAX_LINES], lp[REVERB_MAX_LINES];
+  float phase;
+  int len, mask, pos;
+  float *wet[2], *sum, *data;
+} reverb_t;
+typedef reverb_t *reverb_p;
+void reverb_init(reverb_t *R, int lines);
+reverb_t *reverb_new(int lines);
+void reverb_destroy(reverb_t *R);
+
+//-------------------------------------
+bool reverb_prime(int x) {
+  for (int d = 2; d * d <= x; ++d)
+    if (x % d == 0)
+      return false;
+  return true;
+}
+
+//-------------------------------------
+// spread the lengths evenly in log time, each a distinct prime number of
+// frames so their echoes don't pile up
+void reverb_lengths(reverb_t *R) {
+  int prev = 0;
+  loop(j, R->lines) {
+    float t = (float)j / (R->lines - 1);
+    int len = REVERB_SHORTEST * powf(REVERB_LONGEST / REVERB_SHORTEST, t) *
+              R->size * audio.rate;
+    len = MAX(len, prev + 1);
+    while (!reverb_prime(len))
+      len++;
+    R->base[j] = prev = len;
+  }
+}
+
+//-------------------------------------
+// 8 or 16, the state is cleared
+void reverb_lines(reverb_t *R, int lines) {
+  R->lines = lines > 8 ? 16 : 8;
+  reverb_lengths(R);
+  loop(j, R->lines) R->cur[j] = R->base[j], R->lp[j] = 0;
+  memset(R->data, 0,
+         REVERB_MAX_LINES * (R->len + 2 * REVERB_GUARD) * sizeof(float));
+}
+
+//-------------------------------------
+// size scales the line lengths, which glide there over the next block
+void reverb_size(reverb_t *R, float size) {
+  R->size = CLIP(size, 0.1, 1);
+  reverb_lengths(R);
+}
+
+//-------------------------------------
+void reverb_init(reverb_t *R, int lines) {
+  ZERO(R, reverb_t);
+
+  R->len = 1;
+  while (R->len < REVERB_LONGEST * 1.1 * audio.rate + REVERB_MAX_FRAMES)
+    R->len <<= 1;
+  R->mask = R->len - 1;
+
+  int line = R->len + 2 * REVERB_GUARD;
+  R->data = mem_calloc(REVERB_MAX_LINES * (line + REVERB_MAX_FRAMES) +
+                           3 * REVERB_MAX_FRAMES,
+                       sizeof(float));
+
+  float *work = R->data + REVERB_MAX_LINES * line;
+  loop(j, REVERB_MAX_LINES) {
+    R->line[j] = R->data + j * line + REVERB_GUARD;
+    R->y[j] = work + j * REVERB_MAX_FRAMES;
+  }
+  sample_loop R->wet[c] = work + (REVERB_MAX_LINES + c) * REVERB_MAX_FRAMES;
+  R->sum = work + (REVERB_MAX_LINES + 2) * REVERB_MAX_FRAMES;
+
+  R->time = 2, R->size = 1, R->damp = 0.3, R->mod = 0.5, R->mix = 0.3;
+  reverb_lines(R, lines);
+}
+
+//-------------------------------------
+reverb_t *reverb_new(int lines) {
+  reverb_t *R = MEM_NEW(reverb_t);
+  reverb_init(R, lines);
+  return R;
+}
+
+//-------------------------------------
+void reverb_destroy(reverb_t *R) { MEM_FREE(R->data); }
+
+//-------------------------------------
+// in place, over n frames of every line
+void reverb_mix(reverb_t *R, int n) {
+  int N = R->lines;
+
+  if (R->matrix == REVERB_HOUSEHOLDER) {
+    // I - 2/N: every line loses 2/N of the sum
+    float *sum = R->sum;
+    memcpy(sum, R->y[0], n * sizeof(float));
+    for (int j = 1; j < N; ++j)
+      block_add(sum, sum, R->y[j], n);
+    loop(j, N) block_lincomb(R->y[j], R->y[j], 1, sum, -2.0 / N, n);
+    return;
+  }
+
+  // fast walsh-hadamard, each butterfly a whole span of frames
+  for (int h = 1; h < N; h <<= 1) {
+    for (int j = 0; j < N; j += h * 2) {
+      loop(k, h) {
+        float *a = R->y[j + k], *b = R->y[j + k + h];
+        int i = 0;
+#ifdef VEC_SIZE
+        block_loop(i, n) {
+          vec_t A = vec_load(a + i), B = vec_load(b + i);
+          vec_store(a + i, vec_add(A, B));
+          vec_store(b + i, vec_sub(A, B));
+        }
+#endif
+        for (; i < n; ++i) {
+          float A = a[i], B = b[i];
+          a[i] = A + B, b[i] = A - B;
+        }
+      }
+    }
+  }
+  loop(j, N) block_mul_s(R->y[j], R->y[j], 1 / sqrtf(N), n);
+}
+
+//-------------------------------------
+void reverb_process(reverb_t *R, const float *in[2], float *out[2],
+                    int frames) {
+  if (!R->data || frames <= 0)
+    return;
+
+  int N = R->lines;
+  float damp = CLIP(R->damp, 0, 0.99);
+  float depth = R->mod * 0.001 * audio.rate;
+  float wet = R->mix, dry = 1 - R->mix;
+
+  // where each line's read glides to by the end of the block
+  float step[REVERB_MAX_LINES], gain[REVERB_MAX_LINES], shortest = R->len;
+  R->phase += REVERB_MOD_RATE * frames / audio.rate;
+  R->phase -= floorf(R->phase);
+  loop(j, N) {
+    float target = R->base[j] + depth * sinf(TAU * (R->phase + (float)j / N));
+    target = CLIP(target, REVERB_GUARD + 1, R->len - REVERB_MAX_FRAMES);
+    step[j] = (target - R->cur[j]) / frames;
+    shortest = MIN(shortest, MIN(target, R->cur[j]));
+
+    // -60db after time seconds
+    gain[j] = powf(10, -3 * R->base[j] / (MAX(R->time, 0.01) * audio.rate));
+  }
+  int piece = CLIP((int)shortest - 2, 1, REVERB_MAX_FRAMES);
+
+  for (int offset = 0; offset < frames; offset += piece) {
+    int n = MIN(frames - offset, piece);
+
+    // read, damp and tap every line
+    sample_loop memset(R->wet[c], 0, n * sizeof(float));
+    loop(j, N) {
+      const float *x = R->line[j];
+      float *y = R->y[j], del = R->cur[j], lp = R->lp[j];
+      loop(i, n) {
+        int whole = (int)del;
+        int k = (R->pos + i - whole - 1) & R->mask;
+        float f = 1 - (del - whole);
+        lp += (1 - damp) * (x[k] + f * (x[k + 1] - x[k]) - lp);
+        y[i] = gain[j] * lp;
+        del += step[j];
+      }
+      R->cur[j] = del, R->lp[j] = lp;
+
+      // alternating signs, so the two sides are uncorrelated
+      float s = j & 2 ? -1 : 1;
+      block_lincomb(R->wet[j & 1], R->wet[j & 1], 1, y, s, n);
+    }
+
+    reverb_mix(R, n);
+
+    // each line is fed its side of the input, then written back
+    loop(j, N) {
+      float *x = R->line[j];
+      const float *src = in[j & 1] + offset;
+      for (int i = 0, k = R->pos; i < n;) {
+        int span = MIN(n - i, R->len - k);
+        block_lincomb(x + k, R->y[j] + i, 1, src + i, 0.25, span);
+        i += span, k = 0;
+      }
+      memcpy(x - REVERB_GUARD, x + R->len - REVERB_GUARD,
+             REVERB_GUARD * sizeof(float));
+      memcpy(x + R->len, x, REVERB_GUARD * sizeof(float));
+    }
+    R->pos = (R->pos + n) & R->mask;
 
-  return C->value;
+    float scale = wet * 2 / sqrtf(N);
+    sample_loop block_lincomb(out[c] + offset, in[c] + offset, dry, R->wet[c],
+                              scale, n);
+  }
 }
 
 //-------------------------------------
 // gran
 //-------------------------------------
+// a grain cloud over a buffer_t. grains start density times a second from a
+// playhead that scans the range at speed, and each has its own hann window
+// (from a table), pitch, pan and start, jittered by pitch_jitter (semitones),
+// spread (0..1) and jitter (seconds). up to GRAN_MAX sound at once, packed
+// at the front of a fixed pool: a finished grain is swapped with the last
+// one, and while the pool is full new grains are skipped
+#define GRAN_MAX 512
+#define GRAN_WINDOW 1024
+#define GRAN_MAX_FRAMES 256
+
+typedef struct {
+  float pos, step;   // in buffer frames
+  float phase, inc;  // through the window table
+  float gain[2];
+  int onset;         // frames into the block it starts at
+} grain_t;
+
 typedef struct {
   sample_t value;
   buffer_t *buf;
-  int size, t;
+  grain_t grain[GRAN_MAX];
+  int num;
+
+  int size;
   bool forward;
-  float rate, pos, gpos, start, end;
+  float rate, speed, density, gain;
+  float pitch_jitter, spread, jitter;
+  float pos, start, end, next;
+  buffer_interp_t interp;
+  float tmp[2][GRAN_MAX_FRAMES];
 } gran_t;
 typedef gran_t *gran_p;
 
+float gran_window[GRAN_WINDOW + 1];
+
+//-------------------------------------
+void gran_fill() {
+  loop(i, GRAN_WINDOW) gran_window[i] = 0.5 - 0.5 * cosf(TAU * i / GRAN_WINDOW);
+}
+pthread_once_t gran_once = PTHREAD_ONCE_INIT;
+
 //-------------------------------------
 void gran_init(gran_t *G) {
   ZERO(G, gran_t);
+  pthread_once(&gran_once, gran_fill);
 
-  G->rate = 1.0;
-  G->pos = G->gpos = 0.0;
+  G->rate = 1.0, G->speed = 1.0;
+  G->pos = 0.0;
   G->forward = 1;
-  G->size = 256;
+  G->size = 2048;
+  G->density = 40, G->gain = 0.3;
   G->start = 0, G->end = 1.0;
 }
 
 //-------------------------------------
 gran_t *gran_new() {
-  gran_t *G = malloc(sizeof(gran_t));
+  gran_t *G = MEM_NEW(gran_t);
   gran_init(G);
   return G;
 }
@@ -893,125 +3735,279 @@ void gran_dur(gran_t *G, float start, float dur) {
 }
 
 //-------------------------------------
-sample_t gran_update(gran_t *G) {
-  if (!G->buf)
-    return sample_zero;
+// a new grain from the playhead, silently dropped when the pool is full
+void gran_spawn(gran_t *G, int onset) {
+  if (G->num >= GRAN_MAX)
+    return;
+
+  buffer_t *B = G->buf;
+  grain_t *R = &G->grain[G->num++];
 
-  uint ipos = (uint)floorf(G->gpos);
-  G->value = buffer_read(G->buf, ipos);
+  float semis = G->pitch_jitter * bi_rand();
+  float step = buffer_rate_scale(B, G->rate * powf(2, semis / 12));
+  R->step = G->forward ? step : -step;
+  R->pos = G->pos + G->jitter * bi_rand() * B->rate;
+  R->pos = CLIP(R->pos, 0, B->len - 2);
 
-  G->pos += G->buf->rate / audio.rate;
-  while (G->pos >= G->buf->len)
-    G->pos -= G->buf->len;
+  R->phase = 0;
+  R->inc = (float)GRAN_WINDOW / MAX(G->size, 16);
+  R->onset = onset;
 
-  G->gpos += (G->forward ? 1 : -1) * buffer_rate_scale(G->buf, G->rate);
+  // equal power
+  float pan = 0.5 + 0.5 * CLIP(G->spread, 0, 1) * bi_rand();
+  R->gain[0] = G->gain * cosf(pan * PI / 2);
+  R->gain[1] = G->gain * sinf(pan * PI / 2);
+}
 
-  float start = G->start * (G->buf->len - 1);
-  float end = G->end * (G->buf->len - 1);
-  if (G->forward && G->gpos > end) {
-    G->gpos = start;
-  } else if (!G->forward && G->gpos < start) {
-    G->gpos = end;
+//-------------------------------------
+// up to n frames of one grain into tmp, returns how many it had left
+int gran_render(gran_t *G, grain_t *R, int n) {
+  // only as far as the window goes
+  int left = ceilf((GRAN_WINDOW - R->phase) / R->inc);
+  n = MIN(n, left);
+
+  float *tmp[2] = {G->tmp[0], G->tmp[1]};
+  buffer_span(G->buf, tmp, R->pos, R->step, n, G->interp);
+
+  float phase = R->phase;
+  int i = 0;
+#ifdef VEC_SIZE
+  vec_t X = vec_add(vec_set1(phase), vec_mul(vec_load(vec_ramp),
+                                             vec_set1(R->inc)));
+  vec_t step = vec_set1(R->inc * VEC_SIZE);
+  vec_t top = vec_set1(GRAN_WINDOW - 0.001);
+  block_loop(i, n) {
+    vec_t w = vec_table(gran_window, vec_min(X, top));
+    sample_loop vec_store(G->tmp[c] + i, vec_mul(vec_load(G->tmp[c] + i), w));
+    X = vec_add(X, step);
   }
+#endif
+  for (; i < n; ++i) {
+    float x = MIN(phase + R->inc * i, GRAN_WINDOW - 0.001);
+    int k = (int)x;
+    float w = gran_window[k] + (x - k) * (gran_window[k + 1] - gran_window[k]);
+    sample_loop G->tmp[c][i] *= w;
+  }
+
+  R->pos += R->step * n, R->phase += R->inc * n;
+  return n;
+}
+
+//-------------------------------------
+// the playhead wraps around the range, either way
+void gran_move(gran_t *G, float frames) {
+  float start = G->start * (G->buf->len - 1), end = G->end * (G->buf->len - 1);
+  G->pos += G->speed * G->buf->rate / audio.rate * frames;
+  if (G->pos > end)
+    G->pos = start;
+  else if (G->pos < start)
+    G->pos = end;
+}
+
+//-------------------------------------
+void gran_process(gran_t *G, const float *in[2], float *out[2], int frames) {
+  buffer_t *B = G->buf;
+
+  sample_loop memset(out[c], 0, MAX(frames, 0) * sizeof(float));
+  if (!B || !B->data || B->len < 2)
+    return;
+
+  for (int offset = 0; offset < frames; offset += GRAN_MAX_FRAMES) {
+    int n = MIN(frames - offset, GRAN_MAX_FRAMES);
 
-  G->t++;
-  if (G->t >= G->size) {
-    G->gpos = G->pos;
-    G->t = 0;
+    // this block's new grains, each from where the playhead is by then
+    float interval = audio.rate / MAX(G->density, 0.01);
+    int done = 0;
+
+    while (G->next < n) {
+      int onset = G->next;
+      gran_move(G, onset - done), done = onset;
+      gran_spawn(G, onset);
+      G->next += interval;
+    }
+    gran_move(G, n - done);
+    G->next -= n;
+
+    // render and mix, finished grains are swapped out for the last one
+    for (int g = 0; g < G->num;) {
+      grain_t *R = &G->grain[g];
+      int onset = R->onset, len = gran_render(G, R, n - onset);
+      R->onset = 0;
+
+      sample_loop {
+        float *o = out[c] + offset + onset;
+        block_lincomb(o, o, 1, G->tmp[c], R->gain[c], len);
+      }
+
+      if (R->phase < GRAN_WINDOW)
+        g++;
+      else
+        *R = G->grain[--G->num];
+    }
   }
 
+  if (frames > 0)
+    G->value = make_sample(out[0][frames - 1], out[1][frames - 1]);
+}
+
+//-------------------------------------
+sample_t gran_update(gran_t *G) {
+  float l, r, *out[2] = {&l, &r};
+  gran_process(G, NULL, out, 1);
   return G->value;
 }
 
 //-------------------------------------
-#define PITCH_MAX_DELAY 5120
+// pitch
+//-------------------------------------
+// a delay line pitch shifter: two taps half a window apart sweep through
+// the window at the rate the pitch needs, each faded in and out with a
+// raised cosine (from a table) so their sum stays at unity. reads are
+// interpolated. the line comes from the mem arena, sized for the window
+// given to pitch_init; pitch_window can shrink it (or grow it back) while
+// running. pitch is in semitones
+#define PITCH_WINDOW 1024
+#define PITCH_FADE_SIZE 512
+#define PITCH_MIN_DELAY 2
 
 typedef struct {
-  struct {
-    float data[PITCH_MAX_DELAY], read[2];
-  } delay[2];
-  sample_t value;
-  float pitch;
-  int write;
+  float *data[2];
+  int len, mask, write, window;
+  float phase, pitch;
   bool active;
+  sample_t value;
 } pitch_t;
 typedef pitch_t *pitch_p;
+void pitch_init(pitch_t *P, int window);
+pitch_t *pitch_new(int window);
+void pitch_destroy(pitch_t *P);
+
+// sin^2, 0 .. 1 over a whole window, with a guard point
+float pitch_fade[PITCH_FADE_SIZE + 1];
+
+//-------------------------------------
+void pitch_fill() {
+  loop(i, PITCH_FADE_SIZE + 1) {
+    float s = sinf(PI * i / PITCH_FADE_SIZE);
+    pitch_fade[i] = s * s;
+  }
+}
+pthread_once_t pitch_once = PTHREAD_ONCE_INIT;
 
 //-------------------------------------
-void pitch_init(pitch_t *P) {
+// window in frames, 0 for PITCH_WINDOW
+void pitch_init(pitch_t *P, int window) {
   ZERO(P, pitch_t);
+  pthread_once(&pitch_once, pitch_fill);
+
+  window = window > 0 ? window : PITCH_WINDOW;
+  P->len = 1;
+  while (P->len < window + PITCH_MIN_DELAY + 2)
+    P->len <<= 1;
+  P->mask = P->len - 1;
 
-  P->pitch = 0;
-  sample_loop P->delay[c].read[1] = PITCH_MAX_DELAY / 2;
+  P->data[0] = mem_calloc(2 * P->len, sizeof(float));
+  P->data[1] = P->data[0] + P->len;
+
+  P->window = window;
   P->active = true;
 }
 
 //-------------------------------------
-pitch_t *pitch_new() {
-  pitch_t *P = malloc(sizeof(pitch_t));
-  pitch_init(P);
+pitch_t *pitch_new(int window) {
+  pitch_t *P = MEM_NEW(pitch_t);
+  pitch_init(P, window);
   return P;
 }
 
 //-------------------------------------
-sample_t pitch_update(pitch_t *P, sample_t input) {
-  if (!P->active)
-    return input;
-
-  float half_delay = PITCH_MAX_DELAY / 2;
-  sample_loop {
-    // set delay times
-    // 1st
-    P->delay[c].read[0] += P->pitch;
-
-    while (P->delay[c].read[0] >= PITCH_MAX_DELAY)
-      P->delay[c].read[0] -= PITCH_MAX_DELAY;
-    while (P->delay[c].read[0] < 0)
-      P->delay[c].read[0] += PITCH_MAX_DELAY;
-
-    // 2nd
-    P->delay[c].read[1] = P->delay[c].read[0] + half_delay;
+void pitch_destroy(pitch_t *P) {
+  MEM_FREE(P->data[0]);
+  P->data[1] = NULL;
+}
 
-    while (P->delay[c].read[1] >= PITCH_MAX_DELAY)
-      P->delay[c].read[1] -= PITCH_MAX_DELAY;
-    while (P->delay[c].read[1] < 0)
-      P->delay[c].read[1] += PITCH_MAX_DELAY;
+//-------------------------------------
+// longer windows smear transients less often but warble more
+void pitch_window(pitch_t *P, int window) {
+  P->window = CLIP(window, 16, P->len - PITCH_MIN_DELAY - 2);
+}
 
-    // triangular envelope
-    float env[2] = {0, 0};
-    env[1] = ABS((P->delay[c].read[0] - half_delay) / half_delay);
-    env[0] = 1 - env[1];
+//-------------------------------------
+float pitch_gain(float phase) {
+  float x = phase * PITCH_FADE_SIZE;
+  // phase - floorf(phase) rounds up to 1 for tiny negative phases
+  int i = MIN((int)x, PITCH_FADE_SIZE - 1);
+  return pitch_fade[i] + (x - i) * (pitch_fade[i + 1] - pitch_fade[i]);
+}
 
-    // calculate delay lines
-    // 1st
-    int r = P->write + P->delay[c].read[0];
-    while (r >= PITCH_MAX_DELAY)
-      r -= PITCH_MAX_DELAY;
+//-------------------------------------
+// x at delay frames behind write, interpolated
+float pitch_read(const float *x, int write, float delay, int mask) {
+  int whole = (int)delay;
+  float f = delay - whole;
+  float a = x[(write - whole) & mask], b = x[(write - whole - 1) & mask];
+  return a + f * (b - a);
+}
 
-    P->value.value[c] = env[0] * P->delay[c].data[(int)r];
+//-------------------------------------
+void pitch_process(pitch_t *P, const float *in[2], float *out[2], int frames) {
+  if (frames <= 0 || !P->data[0])
+    return;
 
-    // 2nd
-    r = P->write + P->delay[c].read[1];
-    while (r >= PITCH_MAX_DELAY)
-      r -= PITCH_MAX_DELAY;
+  if (!P->active) {
+    sample_loop if (out[c] != in[c])
+        memcpy(out[c], in[c], frames * sizeof(float));
+    return;
+  }
 
-    P->value.value[c] += env[1] * P->delay[c].data[(int)r];
+  // the delay grows by 1 - ratio frames every frame
+  float ratio = powf(2, P->pitch / 12);
+  float window = P->window, inc = (1 - ratio) / window;
+  float phase = P->phase;
+  int write = P->write;
+
+  loop(i, frames) {
+    float p0 = phase, p1 = phase + 0.5;
+    p1 -= p1 >= 1;
+
+    float g0 = pitch_gain(p0), g1 = 1 - g0;
+    float d0 = PITCH_MIN_DELAY + p0 * window;
+    float d1 = PITCH_MIN_DELAY + p1 * window;
+
+    sample_loop {
+      float *x = P->data[c];
+      x[write] = in[c][i];
+      out[c][i] = g0 * pitch_read(x, write, d0, P->mask) +
+                  g1 * pitch_read(x, write, d1, P->mask);
+    }
 
-    // both
-    P->delay[c].data[P->write] = input.value[c];
+    write = (write + 1) & P->mask;
+    phase += inc;
+    phase -= floorf(phase);
   }
 
-  P->write++;
-  if (P->write >= PITCH_MAX_DELAY)
-    P->write = 0;
+  P->phase = phase, P->write = write;
+  P->value = make_sample(out[0][frames - 1], out[1][frames - 1]);
+}
 
-  return P->value;
+//-------------------------------------
+sample_t pitch_update(pitch_t *P, sample_t input) {
+  const float *in[2] = {&input.value[0], &input.value[1]};
+  float l, r, *out[2] = {&l, &r};
+  pitch_process(P, in, out, 1);
+  return P->active ? P->value : input;
 }
 
 //-------------------------------------
 // filter
 //-------------------------------------
+// FILTER_BIQUAD is the rbj cookbook biquad, worked out with sin/cos on every
+// filter_set. FILTER_SVF is a topology preserving state variable filter with
+// the same responses, whose coefficient comes from a table: changes to freq
+// and res glide over the next block instead of stepping, and the cutoff can
+// even be given per sample (filter_svf_process)
 typedef enum { LPF, HPF, BPF } filter_type_t;
+typedef enum { FILTER_BIQUAD, FILTER_SVF } filter_mode_t;
 typedef struct {
   struct {
     float y0, y1, y2;
@@ -1021,7 +4017,12 @@ typedef struct {
   float a0, a1, a2;
   float alpha, w0, cos_w0;
   filter_type_t type;
+  filter_mode_t mode;
   float freq, res, gain;
+  struct {
+    float ic1[2], ic2[2];
+    float g, k;
+  } svf;
   sample_t value;
 } filter_t;
 typedef filter_t *filter_p;
@@ -1032,23 +4033,114 @@ sample_t filter_update(filter_t *F, sample_t in);
 void filter_res(filter_t *F, float res);
 void filter_gain(filter_t *F, float gain);
 void filter_set(filter_t *F, filter_type_t type, float freq);
+void filter_mode(filter_t *F, filter_mode_t mode);
+void filter_send(filter_t *F, filter_type_t type, float freq, float res);
+void filter_svf_process(filter_t *F, const float *in[2], float *lp[2],
+                        float *hp[2], float *bp[2], const float *freq,
+                        int frames);
+
+// tan(PI * f) for f = 0 to 0.5 of the sample rate, for the svf coefficient
+#define SVF_TAN_SIZE 4096
+float svf_tan[SVF_TAN_SIZE + 1];
+
+//-------------------------------------
+// the last entry is tan(PI / 2), so x stops one short of it
+float svf_g(float freq) {
+  float x = CLIP(freq / audio.rate, 0, 0.5) * 2 * SVF_TAN_SIZE;
+  x = MIN(x, SVF_TAN_SIZE - 1);
+  int i = x;
+  return svf_tan[i] + (x - i) * (svf_tan[i + 1] - svf_tan[i]);
+}
+
+//-------------------------------------
+void svf_fill() {
+  loop(i, SVF_TAN_SIZE + 1) svf_tan[i] = tan(PI * 0.5 * i / SVF_TAN_SIZE);
+}
+pthread_once_t svf_once = PTHREAD_ONCE_INIT;
 
 //-------------------------------------
 void filter_init(filter_t *F) {
   ZERO(F, filter_t);
   filter_res(F, 1);
   filter_set(F, LPF, 1000);
+  pthread_once(&svf_once, svf_fill);
 }
 
 //-------------------------------------
 filter_t *filter_new() {
-  filter_t *F = NEW(filter_t);
+  filter_t *F = MEM_NEW(filter_t);
   filter_init(F);
   return F;
 }
 
+//-------------------------------------
+// one svf step: v0 in, lp/bp/hp out. a1..a3 come from g and k
+#define SVF_TICK(ic1, ic2, v0, lp, bp, hp)                                     \
+  {                                                                            \
+    float v3 = v0 - ic2;                                                       \
+    float v1 = a1 * ic1 + a2 * v3;                                             \
+    float v2 = ic2 + a2 * ic1 + a3 * v3;                                       \
+    ic1 = 2 * v1 - ic1, ic2 = 2 * v2 - ic2;                                    \
+    lp = v2, bp = v1, hp = v0 - k * v1 - v2;                                   \
+  }
+
+//-------------------------------------
+// lp, hp and bp at once, any of them can be NULL. freq gives the cutoff for
+// every frame in hz; without it the cutoff and res glide from where they
+// were to F->freq and F->res over the block
+void filter_svf_process(filter_t *F, const float *in[2], float *lp[2],
+                        float *hp[2], float *bp[2], const float *freq,
+                        int frames) {
+  if (frames <= 0)
+    return;
+
+  float g = F->svf.g, k = F->svf.k;
+  float to_g = svf_g(F->freq), to_k = 1 / F->res;
+  if (g == 0)
+    g = to_g, k = to_k;
+
+  float dg = (to_g - g) / frames, dk = (to_k - k) / frames;
+  float ic1[2] = {F->svf.ic1[0], F->svf.ic1[1]};
+  float ic2[2] = {F->svf.ic2[0], F->svf.ic2[1]};
+
+  for (int i = 0; i < frames; ++i) {
+    if (freq)
+      g = svf_g(freq[i]), k = to_k;
+    else
+      g += dg, k += dk;
+
+    float a1 = 1 / (1 + g * (g + k)), a2 = g * a1, a3 = g * a2;
+    sample_loop {
+      float l, b, h;
+      SVF_TICK(ic1[c], ic2[c], in[c][i], l, b, h);
+      if (lp)
+        lp[c][i] = l;
+      if (hp)
+        hp[c][i] = h;
+      if (bp)
+        bp[c][i] = b;
+    }
+  }
+
+  sample_loop F->svf.ic1[c] = ic1[c], F->svf.ic2[c] = ic2[c];
+  F->svf.g = freq ? to_g : g, F->svf.k = to_k;
+}
+
 //-------------------------------------
 sample_t filter_update(filter_t *F, sample_t in) {
+  if (F->mode == FILTER_SVF) {
+    float g = F->svf.g = svf_g(F->freq), k = F->svf.k = 1 / F->res;
+    float a1 = 1 / (1 + g * (g + k)), a2 = g * a1, a3 = g * a2;
+
+    sample_loop {
+      float l, b, h;
+      SVF_TICK(F->svf.ic1[c], F->svf.ic2[c], in.value[c], l, b, h);
+      F->value.value[c] = F->type == LPF ? l : F->type == HPF ? h : b;
+    }
+
+    return F->value;
+  }
+
   sample_loop {
     typeof(F->t[c]) *t = &F->t[c];
     t->y2 = t->y1;
@@ -1067,6 +4159,43 @@ sample_t filter_update(filter_t *F, sample_t in) {
   return F->value;
 }
 
+//-------------------------------------
+void filter_process(filter_t *F, const float *in[2], float *out[2],
+                    int frames) {
+  if (frames <= 0)
+    return;
+
+  if (F->mode == FILTER_SVF) {
+    filter_svf_process(F, in, F->type == LPF ? out : NULL,
+                       F->type == HPF ? out : NULL, F->type == BPF ? out : NULL,
+                       NULL, frames);
+    sample_loop F->value.value[c] = out[c][frames - 1];
+    return;
+  }
+
+  const float g = 1.0 / F->a0;
+  const float b0 = F->b0 * g, b1 = F->b1 * g, b2 = F->b2 * g;
+  const float a1 = F->a1 * g, a2 = F->a2 * g;
+
+  sample_loop {
+    typeof(F->t[c]) *t = &F->t[c];
+    float x1 = t->x1, x2 = t->x2;
+    float y0 = t->y0, y1 = t->y1, y2 = t->y2;
+
+    for (int i = 0; i < frames; ++i) {
+      float x = in[c][i];
+      y2 = y1, y1 = y0;
+      y0 = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+      x2 = x1, x1 = x;
+      out[c][i] = y0;
+    }
+
+    t->x1 = x1, t->x2 = x2;
+    t->y0 = y0, t->y1 = y1, t->y2 = y2;
+    F->value.value[c] = y0;
+  }
+}
+
 //-------------------------------------
 void filter_res(filter_t *F, float res) {
   F->res = MAX(res, 0.001);
@@ -1076,11 +4205,20 @@ void filter_res(filter_t *F, float res) {
 //-------------------------------------
 void filter_gain(filter_t *F, float gain) { float A = pow(10, F->gain / 40.0); }
 
+//-------------------------------------
+// the state of one mode doesn't carry over to the other
+void filter_mode(filter_t *F, filter_mode_t mode) {
+  F->mode = mode;
+  memset(F->t, 0, sizeof(F->t));
+  memset(&F->svf, 0, sizeof(F->svf));
+}
+
 //-------------------------------------
 void filter_set(filter_t *F, filter_type_t type, float freq) {
   F->type = type;
   F->freq = MAX(freq, 10);
 
+  // worked out in both modes, so switching to the biquad later is safe
   F->w0 = TAU * F->freq / audio.rate;
   F->alpha = sin(F->w0) / (2.0 * F->res);
   F->cos_w0 = cos(F->w0);
@@ -1117,4 +4255,453 @@ void filter_set(filter_t *F, filter_type_t type, float freq) {
   };
 }
 
+//-------------------------------------
+// filter_set + filter_res from another thread. the coefficients are worked
+// out here, and only copied over on the audio thread
+typedef struct {
+  float b0, b1, b2, a0, a1, a2;
+  float freq, res;
+  filter_type_t type;
+} filter_coef_t;
+
+void filter_apply(void *X, const void *data) {
+  filter_t *F = X;
+  const filter_coef_t *C = data;
+
+  F->b0 = C->b0, F->b1 = C->b1, F->b2 = C->b2;
+  F->a0 = C->a0, F->a1 = C->a1, F->a2 = C->a2;
+  F->freq = C->freq, F->res = C->res, F->type = C->type;
+}
+
+void filter_send(filter_t *F, filter_type_t type, float freq, float res) {
+  filter_t T;
+  ZERO(&T, filter_t);
+  T.mode = F->mode;
+  T.res = MAX(res, 0.001);
+  filter_set(&T, type, freq);
+
+  filter_coef_t C = {T.b0, T.b1, T.b2, T.a0, T.a1, T.a2, T.freq, T.res, T.type};
+  ctrl_send(filter_apply, F, &C, sizeof(C));
+}
+
+//-------------------------------------
+// fbank
+//-------------------------------------
+// a bank of biquads laid out side by side (struct of arrays), so VEC_SIZE
+// of them run in each instruction. band data is interleaved by frame: band
+// b of frame i is at [i * stride + b], where stride is num rounded up to a
+// whole number of vectors. spare bands have all zero coefficients
+#define FBANK_MAX_FRAMES 256
+
+#ifdef VEC_SIZE
+#define FBANK_LANES VEC_SIZE
+#else
+#define FBANK_LANES 4
+#endif
+
+typedef struct {
+  int num, stride;
+  float *b0, *b1, *b2, *a1, *a2;
+  float *z1, *z2;
+} fbank_t;
+typedef fbank_t *fbank_p;
+void fbank_init(fbank_t *B, int num);
+fbank_t *fbank_new(int num);
+void fbank_destroy(fbank_t *B);
+
+//-------------------------------------
+void fbank_init(fbank_t *B, int num) {
+  ZERO(B, fbank_t);
+
+  B->num = num;
+  B->stride = (num + FBANK_LANES - 1) / FBANK_LANES * FBANK_LANES;
+
+  float *data = mem_calloc(7 * B->stride, sizeof(float));
+  float **arrays[7] = {&B->b0, &B->b1, &B->b2, &B->a1,
+                       &B->a2, &B->z1, &B->z2};
+  loop(a, 7) *arrays[a] = data + a * B->stride;
+}
+
+//-------------------------------------
+fbank_t *fbank_new(int num) {
+  fbank_t *B = MEM_NEW(fbank_t);
+  fbank_init(B, num);
+  return B;
+}
+
+//-------------------------------------
+void fbank_destroy(fbank_t *B) { MEM_FREE(B->b0); }
+
+//-------------------------------------
+// the same coefficients filter_set would give, gain scales the output
+void fbank_set(fbank_t *B, int band, filter_type_t type, float freq, float res,
+               float gain) {
+  filter_t T;
+  ZERO(&T, filter_t);
+  T.res = MAX(res, 0.001);
+  filter_set(&T, type, freq);
+
+  float g = 1 / T.a0;
+  B->b0[band] = T.b0 * g * gain;
+  B->b1[band] = T.b1 * g * gain;
+  B->b2[band] = T.b2 * g * gain;
+  B->a1[band] = T.a1 * g;
+  B->a2[band] = T.a2 * g;
+}
+
+//-------------------------------------
+// every band, spaced evenly in pitch from lo to hi (hz)
+void fbank_set_bands(fbank_t *B, filter_type_t type, float lo, float hi,
+                     float res, float gain) {
+  loop(b, B->num) {
+    float t = B->num > 1 ? (float)b / (B->num - 1) : 0;
+    fbank_set(B, b, type, lo * powf(hi / lo, t), res, gain);
+  }
+}
+
+//-------------------------------------
+void fbank_clear(fbank_t *B) {
+  memset(B->z1, 0, 2 * B->stride * sizeof(float));
+}
+
+//-------------------------------------
+// one frame of every band. x is the input for each band
+#define FBANK_TICK(B, b, x, y)                                                 \
+  {                                                                            \
+    y = B->b0[b] * x + B->z1[b];                                               \
+    B->z1[b] = B->b1[b] * x - B->a1[b] * y + B->z2[b];                         \
+    B->z2[b] = B->b2[b] * x - B->a2[b] * y;                                    \
+  }
+
+//-------------------------------------
+// the same mono input through every band, out is band interleaved (n frames
+// of stride). with in_stride set, in is band interleaved as well, and each
+// band gets its own input
+void fbank_run(fbank_t *B, const float *in, int in_stride, float *out, int n) {
+  loop(i, n) {
+    float *y = out + i * B->stride;
+    int b = 0;
+#ifdef VEC_SIZE
+    vec_t mono = vec_set1(in[i * (in_stride ? in_stride : 1)]);
+    for (; b < B->stride; b += VEC_SIZE) {
+      vec_t x = in_stride ? vec_load(in + i * in_stride + b) : mono;
+      vec_t Y = vec_add(vec_mul(vec_load(B->b0 + b), x), vec_load(B->z1 + b));
+      vec_t z1 = vec_sub(vec_mul(vec_load(B->b1 + b), x),
+                         vec_mul(vec_load(B->a1 + b), Y));
+      vec_t z2 = vec_sub(vec_mul(vec_load(B->b2 + b), x),
+                         vec_mul(vec_load(B->a2 + b), Y));
+      vec_store(B->z1 + b, vec_add(z1, vec_load(B->z2 + b)));
+      vec_store(B->z2 + b, z2);
+      vec_store(y + b, Y);
+    }
+#endif
+    for (; b < B->stride; ++b) {
+      float x = in_stride ? in[i * in_stride + b] : in[i];
+      FBANK_TICK(B, b, x, y[b]);
+    }
+  }
+}
+
+//-------------------------------------
+// analysis: mono in, every band out (band interleaved)
+void fbank_split(fbank_t *B, const float *in, float *out, int n) {
+  fbank_run(B, in, 0, out, n);
+}
+
+//-------------------------------------
+// synthesis: sums the bands of each frame into out, gain (per band) may be
+// NULL
+void fbank_sum(fbank_t *B, const float *bands, const float *gain, float *out,
+               int n) {
+  loop(i, n) {
+    const float *x = bands + i * B->stride;
+    float sum = 0;
+    if (gain)
+      loop(b, B->num) sum += x[b] * gain[b];
+    else
+      loop(b, B->num) sum += x[b];
+    out[i] = sum;
+  }
+}
+
+//-------------------------------------
+// vocoder
+//-------------------------------------
+// a channel vocoder on three fbank_t: the modulator's bands are envelope
+// followed, and scale the same bands of the carrier. in[0], in[1] are the
+// carrier and in[2], in[3] the modulator, so in a graph it needs two audio
+// inputs: make it with graph_vocoder, not graph_unit
+typedef struct {
+  fbank_t mod, car[2];
+  float *env, *bands, *data;
+  float attack, release, gain;
+} vocoder_t;
+typedef vocoder_t *vocoder_p;
+void vocoder_init(vocoder_t *V, int num, float lo, float hi);
+vocoder_t *vocoder_new(int num, float lo, float hi);
+void vocoder_destroy(vocoder_t *V);
+
+//-------------------------------------
+// attack and release in seconds
+void vocoder_times(vocoder_t *V, float attack, float release) {
+  V->attack = 1 - expf(-1 / (MAX(attack, 1e-5) * audio.rate));
+  V->release = 1 - expf(-1 / (MAX(release, 1e-5) * audio.rate));
+}
+
+//-------------------------------------
+void vocoder_init(vocoder_t *V, int num, float lo, float hi) {
+  ZERO(V, vocoder_t);
+
+  // neighbouring bands cross about 3db down, each peaks at unity
+  float q = 1 / (powf(hi / lo, 1.0 / MAX(num - 1, 1)) - 1);
+  q = CLIP(q, 0.5, 50);
+
+  fbank_init(&V->mod, num);
+  fbank_set_bands(&V->mod, BPF, lo, hi, q, 1 / q);
+  sample_loop {
+    fbank_init(&V->car[c], num);
+    fbank_set_bands(&V->car[c], BPF, lo, hi, q, 1 / q);
+  }
+
+  int size = V->mod.stride * FBANK_MAX_FRAMES;
+  V->data = mem_calloc(V->mod.stride + 2 * size, sizeof(float));
+  V->env = V->data;
+  V->bands = V->env + V->mod.stride;
+
+  vocoder_times(V, 0.002, 0.05);
+  V->gain = 2;
+}
+
+//-------------------------------------
+vocoder_t *vocoder_new(int num, float lo, float hi) {
+  vocoder_t *V = MEM_NEW(vocoder_t);
+  vocoder_init(V, num, lo, hi);
+  return V;
+}
+
+//-------------------------------------
+void vocoder_destroy(vocoder_t *V) {
+  fbank_destroy(&V->mod);
+  sample_loop fbank_destroy(&V->car[c]);
+  MEM_FREE(V->data);
+}
+
+//-------------------------------------
+// turns band interleaved samples into their envelopes, in place
+void vocoder_follow(vocoder_t *V, float *bands, int n) {
+  int stride = V->mod.stride;
+  float *env = V->env;
+
+  loop(i, n) {
+    float *x = bands + i * stride;
+    int b = 0;
+#ifdef VEC_SIZE
+    vec_t att = vec_set1(V->attack), rel = vec_set1(V->release);
+    vec_t zero = vec_set1(0);
+    for (; b < stride; b += VEC_SIZE) {
+      vec_t r = vec_load(x + b), e = vec_load(env + b);
+      r = vec_max(r, vec_sub(zero, r));
+      vec_t k = vec_select(vec_gt(r, e), att, rel);
+      e = vec_add(e, vec_mul(k, vec_sub(r, e)));
+      vec_store(env + b, e);
+      vec_store(x + b, e);
+    }
+#endif
+    for (; b < stride; ++b) {
+      float r = fabsf(x[b]);
+      env[b] += (r > env[b] ? V->attack : V->release) * (r - env[b]);
+      x[b] = env[b];
+    }
+  }
+}
+
+//-------------------------------------
+void vocoder_process(vocoder_t *V, const float *in[4], float *out[2],
+                     int frames) {
+  int stride = V->mod.stride;
+  float *env = V->bands, *car = V->bands + stride * FBANK_MAX_FRAMES;
+
+  for (int offset = 0; offset < frames; offset += FBANK_MAX_FRAMES) {
+    int n = MIN(frames - offset, FBANK_MAX_FRAMES);
+
+    // the modulator in mono, through car as scratch
+    loop(i, n) car[i] = 0.5 * (in[2][offset + i] + in[3][offset + i]);
+    fbank_split(&V->mod, car, env, n);
+    vocoder_follow(V, env, n);
+    block_mul_s(env, env, V->gain, n * stride);
+
+    sample_loop {
+      fbank_split(&V->car[c], in[c] + offset, car, n);
+      block_mul(car, car, env, n * stride);
+      fbank_sum(&V->car[c], car, NULL, out[c] + offset, n);
+    }
+  }
+}
+
+//-------------------------------------
+// over
+//-------------------------------------
+// runs a block shaper (any of the effect_*_block functions) at 2, 4 or 8
+// times the rate, so driving it hard doesn't alias. each doubling is a
+// half-band fir split into its two phases: one phase is just a delay, so only
+// the other is multiplied. the first stage has the steepest filter, later
+// ones only have to reject images far above the audio band. factor can be
+// changed with ctrl_int while running
+#define OVER_MAX_STAGES 3
+#define OVER_MAX_FRAMES 512
+#define OVER_MAX_TAPS 32
+
+typedef void (*shaper_t)(float *out, const float *in, float amt, int n);
+
+typedef struct {
+  shaper_t shaper;
+  float amt;
+  int factor;
+
+  // per stage and channel: the low rate history for going up, and the even
+  // and odd phases of the high rate history for coming back down
+  float *up[OVER_MAX_STAGES][2], *even[OVER_MAX_STAGES][2],
+      *odd[OVER_MAX_STAGES][2];
+  float *work[2], *tmp, *data;
+} over_t;
+typedef over_t *over_p;
+void over_init(over_t *O, shaper_t shaper, int factor);
+over_t *over_new(shaper_t shaper, int factor);
+void over_destroy(over_t *O);
+
+// even taps of each stage's half-band filter, the odd ones are all zero but
+// the centre (0.5)
+const int over_taps[OVER_MAX_STAGES] = {32, 12, 8};
+float over_coef[OVER_MAX_STAGES][OVER_MAX_TAPS];
+
+//-------------------------------------
+// windowed sinc, blackman
+void over_design() {
+  loop(s, OVER_MAX_STAGES) {
+    int taps = over_taps[s], len = taps * 2 - 1;
+    float sum = 0;
+
+    loop(j, taps) {
+      int i = j * 2;
+      double x = (i - (len - 1) / 2) * 0.5;
+      double w = 0.42 - 0.5 * cos(TAU * i / (len - 1)) +
+                 0.08 * cos(2 * TAU * i / (len - 1));
+      sum += over_coef[s][j] = 0.5 * sin(PI * x) / (PI * x) * w;
+    }
+
+    // unity gain at dc, with the centre tap adding the other half
+    loop(j, taps) over_coef[s][j] *= 0.5 / sum;
+  }
+}
+pthread_once_t over_once = PTHREAD_ONCE_INIT;
+
+//-------------------------------------
+int over_stages(int factor) {
+  return factor >= 8 ? 3 : factor >= 4 ? 2 : factor >= 2 ? 1 : 0;
+}
+
+//-------------------------------------
+void over_init(over_t *O, shaper_t shaper, int factor) {
+  ZERO(O, over_t);
+
+  pthread_once(&over_once, over_design);
+
+  O->shaper = shaper;
+  O->factor = factor;
+  O->amt = 1;
+
+  size_t size = 2 * (OVER_MAX_FRAMES << OVER_MAX_STAGES) +
+                (OVER_MAX_FRAMES << (OVER_MAX_STAGES - 1));
+  loop(s, OVER_MAX_STAGES) {
+    size += 2 * 3 * (over_taps[s] - 1 + (OVER_MAX_FRAMES << s));
+  }
+
+  float *data = O->data = mem_calloc(size, sizeof(float));
+  loop(s, OVER_MAX_STAGES) sample_loop {
+    int len = over_taps[s] - 1 + (OVER_MAX_FRAMES << s);
+    O->up[s][c] = data, data += len;
+    O->even[s][c] = data, data += len;
+    O->odd[s][c] = data, data += len;
+  }
+  O->work[0] = data, data += OVER_MAX_FRAMES << OVER_MAX_STAGES;
+  O->work[1] = data, data += OVER_MAX_FRAMES << OVER_MAX_STAGES;
+  O->tmp = data;
+}
+
+//-------------------------------------
+over_t *over_new(shaper_t shaper, int factor) {
+  over_t *O = MEM_NEW(over_t);
+  over_init(O, shaper, factor);
+  return O;
+}
+
+//-------------------------------------
+void over_destroy(over_t *O) { MEM_FREE(O->data); }
+
+//-------------------------------------
+// m samples in, 2m out
+void over_up(int s, float *hist, const float *in, float *out, float *tmp,
+             int m) {
+  int taps = over_taps[s];
+  memcpy(hist + taps - 1, in, m * sizeof(float));
+
+  block_fir(tmp, hist, over_coef[s], taps, m);
+  loop(i, m) {
+    out[i * 2] = 2 * tmp[i];
+    out[i * 2 + 1] = hist[i + taps / 2];
+  }
+
+  memmove(hist, hist + m, (taps - 1) * sizeof(float));
+}
+
+//-------------------------------------
+// 2m samples in, m out
+void over_down(int s, float *even, float *odd, const float *in, float *out,
+               int m) {
+  int taps = over_taps[s];
+  loop(i, m) {
+    even[taps - 1 + i] = in[i * 2];
+    odd[taps - 1 + i] = in[i * 2 + 1];
+  }
+
+  block_fir(out, even, over_coef[s], taps, m);
+  loop(i, m) out[i] += 0.5 * odd[i + taps / 2 - 1];
+
+  memmove(even, even + m, (taps - 1) * sizeof(float));
+  memmove(odd, odd + m, (taps - 1) * sizeof(float));
+}
+
+//-------------------------------------
+void over_process(over_t *O, const float *in[2], float *out[2], int frames) {
+  int stages = over_stages(O->factor);
+
+  if (stages == 0) {
+    sample_loop O->shaper(out[c], in[c], O->amt, frames);
+    return;
+  }
+
+  for (int offset = 0; offset < frames; offset += OVER_MAX_FRAMES) {
+    int n = MIN(frames - offset, OVER_MAX_FRAMES);
+
+    sample_loop {
+      const float *x = in[c] + offset;
+      int m = n, w = 0;
+
+      loop(s, stages) {
+        over_up(s, O->up[s][c], x, O->work[w], O->tmp, m);
+        x = O->work[w], w = !w, m *= 2;
+      }
+
+      O->shaper(O->work[!w], x, O->amt, m);
+
+      for (int s = stages - 1; s >= 0; --s) {
+        float *y = s ? O->work[w] : out[c] + offset;
+        m /= 2;
+        over_down(s, O->even[s][c], O->odd[s][c], O->work[!w], y, m);
+        w = !w;
+      }
+    }
+  }
+}
+
 #endif
@@ -0,0 +1,502 @@
+#include "compakt.h"
+
+//-------------------------------------
+// bench
+//-------------------------------------
+// runs offline, without jack or a window. each test prints the cost in ns
+// per stereo frame
+
+#define BENCH_FRAMES 256
+#define BENCH_REPS 20000
+
+float bench_in[2][BENCH_FRAMES], bench_out[2][BENCH_FRAMES];
+float bench_sink;
+
+//-------------------------------------
+double bench_now() { return time_now() * 1e9; }
+
+//-------------------------------------
+void bench_fill() {
+  loop(i, BENCH_FRAMES) sample_loop bench_in[c][i] = bi_rand() * 2;
+}
+
+//-------------------------------------
+#define BENCH(var, ...)                                                        \
+  double var;                                                                  \
+  {                                                                            \
+    double t = bench_now();                                                    \
+    loop(r, BENCH_REPS) {                                                      \
+      __VA_ARGS__;                                                             \
+      __asm__ volatile("" ::: "memory");                                       \
+    }                                                                          \
+    var = (bench_now() - t) / ((double)BENCH_REPS * BENCH_FRAMES);             \
+    bench_sink += bench_out[0][0];                                             \
+  }
+
+#define BENCH_SCALAR(expr)                                                     \
+  loop(i, BENCH_FRAMES) {                                                      \
+    sample_t a = make_sample(bench_in[0][i], bench_in[1][i]);                  \
+    sample_t b = make_sample(bench_out[0][i], bench_out[1][i]);                \
+    sample_t s = expr;                                                         \
+    sample_loop bench_out[c][i] = s.value[c];                                  \
+  }
+
+#define BENCH_BLOCK(call) sample_loop call
+
+//-------------------------------------
+void bench_print(const char *name, double scalar, double block) {
+  printf("%-16s %10.3f %10.3f %8.2fx\n", name, scalar, block, scalar / block);
+}
+
+//-------------------------------------
+void bench_kernels() {
+  printf("%-16s %10s %10s %9s\n", "kernel", "scalar", "block", "speedup");
+
+#define BENCH_KERNEL(name, expr, call)                                         \
+  {                                                                            \
+    BENCH(scalar, BENCH_SCALAR(expr));                                         \
+    BENCH(block, BENCH_BLOCK(call));                                           \
+    bench_print(name, scalar, block);                                          \
+  }
+
+#define O bench_out[c]
+#define A bench_in[c]
+
+  BENCH_KERNEL("add", sample_add(a, b), block_add(O, A, O, BENCH_FRAMES));
+  BENCH_KERNEL("mul_s", sample_mul_s(a, 0.5),
+               block_mul_s(O, A, 0.5, BENCH_FRAMES));
+  BENCH_KERNEL("lincomb", sample_lincomb(a, 0.3, b, 0.7),
+               block_lincomb(O, A, 0.3, O, 0.7, BENCH_FRAMES));
+  BENCH_KERNEL("clip", sample_clip(a, -0.5, 0.5),
+               block_clip(O, A, -0.5, 0.5, BENCH_FRAMES));
+  BENCH_KERNEL("wrap", sample_wrap(a, -0.5, 0.5),
+               block_wrap(O, A, -0.5, 0.5, BENCH_FRAMES));
+  BENCH_KERNEL("overdrive", effect_overdrive(a, 4),
+               effect_overdrive_block(O, A, 4, BENCH_FRAMES));
+  BENCH_KERNEL("fold", effect_fold(a, 0.6),
+               effect_fold_block(O, A, 0.6, BENCH_FRAMES));
+  BENCH_KERNEL("bit", effect_bit(a, 4),
+               effect_bit_block(O, A, 4, BENCH_FRAMES));
+
+#undef O
+#undef A
+#undef BENCH_KERNEL
+}
+
+//-------------------------------------
+// the cost of each oversampling factor, around a hard clip
+void bench_over() {
+  const float *in[2] = {bench_in[0], bench_in[1]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  printf("\n%-16s %10s %10s\n", "over", "ns", "x base");
+
+  double base = 0;
+  for (int factor = 1; factor <= 8; factor *= 2) {
+    over_t *O = over_new(effect_overdrive_block, factor);
+    O->amt = 4;
+
+    BENCH(cost, over_process(O, in, out, BENCH_FRAMES));
+    if (factor == 1)
+      base = cost;
+
+    char name[16];
+    snprintf(name, 16, "overdrive %ix", factor);
+    printf("%-16s %10.3f %9.2fx\n", name, cost, cost / base);
+
+    over_destroy(O), mem_free(O);
+  }
+}
+
+//-------------------------------------
+// the biquad against the svf, with a fixed cutoff and with one per frame
+void bench_filter() {
+  const float *in[2] = {bench_in[0], bench_in[1]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+  float freq[BENCH_FRAMES];
+  loop(i, BENCH_FRAMES) freq[i] = 1000 + 500 * sinf(i * 0.1);
+
+  filter_t *F = filter_new();
+  filter_res(F, 2);
+
+  printf("\n%-16s %10s\n", "filter", "ns");
+
+  BENCH(cost_biquad, filter_process(F, in, out, BENCH_FRAMES));
+  filter_mode(F, FILTER_SVF);
+  BENCH(cost_svf, filter_process(F, in, out, BENCH_FRAMES));
+  BENCH(cost_svf_mod,
+        filter_svf_process(F, in, out, NULL, NULL, freq, BENCH_FRAMES));
+
+  printf("%-16s %10.3f\n", "biquad", cost_biquad);
+  printf("%-16s %10.3f\n", "svf", cost_svf);
+  printf("%-16s %10.3f\n", "svf per frame", cost_svf_mod);
+
+  mem_free(F);
+}
+
+//-------------------------------------
+// ns per oscillator per frame, a wavetable bank against libm's sinf
+#define BENCH_PARTIALS 64
+
+void bench_bank() {
+  wave_t *W = wave_new(WAVE_SAW);
+  bank_t *B = bank_new(W, BENCH_PARTIALS);
+  float phase[BENCH_PARTIALS] = {0};
+
+  loop(o, BENCH_PARTIALS) B->freq[o] = 55 * (o + 1), B->amp[o] = 1.0 / (o + 1);
+
+  printf("\n%-16s %10s\n", "osc", "ns");
+
+  BENCH(cost_sin, {
+    loop(o, BENCH_PARTIALS) loop(i, BENCH_FRAMES) {
+      bench_out[0][i] += B->amp[o] * sinf(TAU * phase[o]);
+      phase[o] += B->freq[o] / audio.rate;
+      phase[o] -= floorf(phase[o]);
+    }
+  });
+  BENCH(cost_bank, bank_render(B, bench_out[0], BENCH_FRAMES));
+
+  printf("%-16s %10.3f\n", "sinf", cost_sin / BENCH_PARTIALS);
+  printf("%-16s %10.3f\n", "bank", cost_bank / BENCH_PARTIALS);
+
+  bank_destroy(B), mem_free(B);
+  wave_destroy(W), mem_free(W);
+
+  // the fft is shared between all partials, so use a lot more of them
+  additive_t *A = additive_new(BENCH_PARTIALS * 16);
+  loop(p, A->num) A->freq[p] = 20 + p * 7.3, A->amp[p] = 1.0 / A->num;
+
+  float *out[2] = {bench_out[0], bench_out[1]};
+  BENCH(cost_add, additive_process(A, NULL, out, BENCH_FRAMES));
+  printf("%-16s %10.3f\n", "additive", cost_add / A->num);
+
+  additive_destroy(A), mem_free(A);
+}
+
+//-------------------------------------
+// ns per band per frame: one fbank_t against a filter_t for every band, on a
+// mono input
+#define BENCH_BANDS 32
+
+void bench_fbank() {
+  const float *in[2] = {bench_in[0], bench_in[0]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+  filter_t F[BENCH_BANDS];
+  fbank_t *B = fbank_new(BENCH_BANDS);
+  float *bands = mem_calloc(B->stride * BENCH_FRAMES, sizeof(float));
+
+  loop(b, BENCH_BANDS) {
+    float freq = 100 * powf(80, (float)b / (BENCH_BANDS - 1));
+    filter_init(&F[b]);
+    filter_res(&F[b], 4);
+    filter_set(&F[b], BPF, freq);
+  }
+  fbank_set_bands(B, BPF, 100, 8000, 4, 1);
+
+  printf("\n%-16s %10s\n", "bands", "ns");
+
+  BENCH(cost_filter,
+        loop(b, BENCH_BANDS) filter_process(&F[b], in, out, BENCH_FRAMES));
+  BENCH(cost_fbank, {
+    fbank_split(B, bench_in[0], bands, BENCH_FRAMES);
+    fbank_sum(B, bands, NULL, bench_out[0], BENCH_FRAMES);
+  });
+
+  // filter_t runs both channels
+  printf("%-16s %10.3f\n", "filter", cost_filter / 2 / BENCH_BANDS);
+  printf("%-16s %10.3f\n", "fbank", cost_fbank / BENCH_BANDS);
+
+  vocoder_t *V = vocoder_new(BENCH_BANDS, 100, 8000);
+  const float *voc_in[4] = {bench_in[0], bench_in[1], bench_in[1], bench_in[0]};
+  BENCH(cost_voc, vocoder_process(V, voc_in, out, BENCH_FRAMES));
+  printf("%-16s %10.3f\n", "vocoder", cost_voc / BENCH_BANDS);
+
+  vocoder_destroy(V), mem_free(V);
+  mem_free(bands);
+  fbank_destroy(B), mem_free(B);
+}
+
+//-------------------------------------
+// ns per tap per frame, with fixed times and with every time moving
+#define BENCH_TAPS 32
+
+void bench_taps() {
+  const float *in[2] = {bench_in[0], bench_in[1]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+  taps_t *T = taps_new(sec2samp(1));
+  loop(t, BENCH_TAPS) taps_add(T, 0.01 + t * 0.0123, 0.5, 0.1);
+
+  printf("\n%-16s %10s %10s\n", "taps", "fixed", "moving");
+
+  const char *names[3] = {"linear", "cubic", "allpass"};
+  loop(m, 3) {
+    T->interp = m;
+    BENCH(cost_fixed, taps_process(T, in, out, BENCH_FRAMES));
+    BENCH(cost_moving, {
+      loop(t, BENCH_TAPS) T->tap[t].time = 0.01 + t * 0.0123 + (r & 1) * 1e-4;
+      taps_process(T, in, out, BENCH_FRAMES);
+    });
+    printf("%-16s %10.3f %10.3f\n", names[m], cost_fixed / BENCH_TAPS,
+           cost_moving / BENCH_TAPS);
+  }
+
+  taps_destroy(T), mem_free(T);
+}
+
+//-------------------------------------
+// the reverb at both sizes, with each matrix
+void bench_reverb() {
+  const float *in[2] = {bench_in[0], bench_in[1]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  printf("\n%-16s %10s %12s\n", "reverb", "hadamard", "householder");
+
+  for (int lines = 8; lines <= 16; lines *= 2) {
+    reverb_t *R = reverb_new(lines);
+
+    BENCH(cost_hadamard, reverb_process(R, in, out, BENCH_FRAMES));
+    R->matrix = REVERB_HOUSEHOLDER;
+    BENCH(cost_householder, reverb_process(R, in, out, BENCH_FRAMES));
+
+    char name[16];
+    snprintf(name, 16, "%i lines", lines);
+    printf("%-16s %10.3f %12.3f\n", name, cost_hadamard, cost_householder);
+
+    reverb_destroy(R), mem_free(R);
+  }
+}
+
+//-------------------------------------
+// a 3 second stereo ir with 64 frame blocks, on this thread plus the
+// background stages
+void bench_conv() {
+  const float *in[2] = {bench_in[0], bench_in[1]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  buffer_t ir;
+  buffer_init(&ir, 3 * audio.rate, 2);
+  loop(i, ir.size) ir.data[i] = bi_rand() * expf(-(i / 2) / audio.rate);
+
+  conv_t *C = conv_new(&ir, 64);
+
+  printf("\n%-16s %10s\n", "conv", "ns");
+  BENCH(cost, conv_process(C, in, out, BENCH_FRAMES));
+  printf("%-16s %10.3f\n", "3s ir", cost);
+
+  conv_destroy(C), mem_free(C);
+  buffer_destroy(&ir);
+}
+
+//-------------------------------------
+// ns per grain per frame, with a couple of hundred grains sounding
+void bench_gran() {
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  buffer_t B;
+  buffer_init(&B, audio.rate, 2);
+  loop(i, B.size) B.data[i] = bi_rand();
+
+  gran_t *G = gran_new();
+  G->buf = &B, G->density = 2000, G->size = 4800;
+  G->pitch_jitter = 0.2, G->spread = 1, G->jitter = 0.05;
+  loop(r, 100) gran_process(G, NULL, out, BENCH_FRAMES);
+
+  printf("\n%-16s %10s\n", "gran", "ns");
+  BENCH(cost, gran_process(G, NULL, out, BENCH_FRAMES));
+  printf("%-16s %10.3f\n", "per grain", cost / G->num);
+
+  mem_free(G);
+  buffer_destroy(&B);
+}
+
+//-------------------------------------
+void bench_pitch() {
+  const float *in[2] = {bench_in[0], bench_in[1]};
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  pitch_t *P = pitch_new(0);
+  P->pitch = 7;
+
+  printf("\n%-16s %10s\n", "pitch", "ns");
+  BENCH(cost, pitch_process(P, in, out, BENCH_FRAMES));
+  printf("%-16s %10.3f\n", "shift", cost);
+
+  pitch_destroy(P), mem_free(P);
+}
+
+//-------------------------------------
+// ns per voice per frame, with 128 one-shots sounding and one more every
+// block stealing the oldest
+void bench_voices() {
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  buffer_t B;
+  buffer_init(&B, 10 * audio.rate, 2);
+  loop(i, B.size) B.data[i] = bi_rand();
+
+  voices_t *V = voices_new(128);
+  loop(v, 128) voices_play(V, &B, v, 1 + v * 0.001, 0.1, bi_rand());
+
+  printf("\n%-16s %10s\n", "voices", "ns");
+  BENCH(cost, {
+    voices_play(V, &B, 0, 1, 0.1, 0);
+    voices_process(V, NULL, out, BENCH_FRAMES);
+  });
+  printf("%-16s %10.3f\n", "per voice", cost / V->size);
+
+  mem_free(V);
+  buffer_destroy(&B);
+}
+
+//-------------------------------------
+// reading a stereo buffer at 1.3x: buffer_read per frame (nearest) against
+// each kind of span read
+void bench_span() {
+  float *out[2] = {bench_out[0], bench_out[1]};
+
+  buffer_t B;
+  buffer_init(&B, audio.rate, 2);
+  loop(i, B.size) B.data[i] = bi_rand();
+
+  printf("\n%-16s %10s\n", "span", "ns");
+
+  BENCH(cost_read, loop(i, BENCH_FRAMES) {
+    sample_t s = buffer_read(&B, floorf(100 + i * 1.3));
+    sample_loop out[c][i] = s.value[c];
+  });
+  printf("%-16s %10.3f\n", "buffer_read", cost_read);
+
+  const char *names[3] = {"linear", "cubic", "sinc"};
+  loop(m, 3) {
+    BENCH(cost, buffer_span(&B, out, 100, 1.3, BENCH_FRAMES, m));
+    printf("%-16s %10.3f\n", names[m], cost);
+  }
+
+  buffer_destroy(&B);
+}
+
+//-------------------------------------
+// the load time conversion, ns per output frame of a second of stereo
+void bench_resample() {
+  printf("\n%-16s %10s\n", "resample", "ns");
+
+  uint rates[3] = {44100, 96000, 22050};
+  loop(r, 3) {
+    buffer_t B;
+    buffer_init(&B, rates[r], 2);
+    loop(i, B.size) B.data[i] = bi_rand();
+    B.rate = rates[r];
+
+    double t = bench_now();
+    buffer_resample(&B, audio.rate);
+    double cost = (bench_now() - t) / B.len;
+    bench_sink += B.data[0];
+
+    char name[32];
+    snprintf(name, sizeof(name), "%u", rates[r]);
+    printf("%-16s %10.3f\n", name, cost);
+    buffer_destroy(&B);
+  }
+}
+
+//-------------------------------------
+// cubic reads through a stream against the same reads from memory. this
+// runs far faster than realtime, so each lap plays the head and half a
+// ring, and the read-ahead gets to refill before the next one (untimed)
+void bench_stream() {
+  float *out[2] = {bench_out[0], bench_out[1]};
+  const char *file = "/tmp/compakt_bench.wav";
+
+  buffer_t B;
+  buffer_init(&B, 20 * audio.rate, 2);
+  loop(i, B.size) B.data[i] = bi_rand();
+
+  drwav wav;
+  drwav_data_format format = {drwav_container_riff, DR_WAVE_FORMAT_IEEE_FLOAT,
+                              2, audio.rate, 32};
+  if (!drwav_init_file_write(&wav, file, &format, NULL)) {
+    buffer_destroy(&B);
+    return;
+  }
+  drwav_write_pcm_frames(&wav, B.len, B.data);
+  drwav_uninit(&wav);
+
+  stream_t S;
+  if (stream_init(&S, file, 0)) {
+    stream_cleanup();
+    buffer_destroy(&B);
+    remove(file);
+    return;
+  }
+
+  printf("\n%-16s %10s\n", "stream", "ns");
+
+  int blocks = (S.head.len + STREAM_RING / 2) / BENCH_FRAMES;
+  double cost[2] = {0, 0};
+  loop(lap, BENCH_REPS / blocks) {
+    stream_seek(&S, 0);
+    while (__atomic_load_n(&S.filled, __ATOMIC_ACQUIRE) != S.gen ||
+           __atomic_load_n(&S.write, __ATOMIC_ACQUIRE) <
+               (uint)blocks * BENCH_FRAMES + STREAM_GUARD)
+      usleep(100);
+
+    loop(k, 2) {
+      double t = bench_now();
+      loop(b, blocks) {
+        if (k)
+          stream_span(&S, out, b * BENCH_FRAMES, 1, BENCH_FRAMES, BUFFER_CUBIC);
+        else
+          buffer_span(&B, out, b * BENCH_FRAMES, 1, BENCH_FRAMES, BUFFER_CUBIC);
+        __asm__ volatile("" ::: "memory");
+      }
+      cost[k] += bench_now() - t;
+    }
+  }
+
+  double frames = (double)(BENCH_REPS / blocks) * blocks * BENCH_FRAMES;
+  printf("%-16s %10.3f\n", "buffer", cost[0] / frames);
+  printf("%-16s %10.3f (%u underruns)\n", "stream", cost[1] / frames,
+         stream_underruns(&S));
+  bench_sink += bench_out[0][0];
+
+  stream_destroy(&S);
+  stream_cleanup();
+  buffer_destroy(&B);
+  remove(file);
+}
+
+//-------------------------------------
+void audio_callback() {}
+void gui_callback() {}
+void midi_callback(uint track, uint ctrl, float value) {}
+
+//-------------------------------------
+int main(void) {
+  audio.rate = 48000;
+  audio.frames = BENCH_FRAMES;
+  bench_fill();
+
+#ifdef VEC_SIZE
+  printf("[bench] vector width %i\n", VEC_SIZE);
+#else
+  printf("[bench] no simd\n");
+#endif
+  printf("[bench] ns per stereo frame, %i frame blocks\n\n", BENCH_FRAMES);
+
+  bench_kernels();
+  bench_over();
+  bench_filter();
+  bench_bank();
+  bench_fbank();
+  bench_taps();
+  bench_reverb();
+  bench_conv();
+  bench_gran();
+  bench_pitch();
+  bench_voices();
+  bench_span();
+  bench_resample();
+  bench_stream();
+
+  return bench_sink == 12345.0;
+}
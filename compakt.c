@@ -34,7 +34,7 @@ struct {
 
 #define FFT_SHIFT_RANGE 4
 void fft_pitchshift_changed(void *X, float value) {
-  fft.shift = powf(2.0, FFT_SHIFT_RANGE * norm2bi(value));
+  ctrl_float(&fft.shift, powf(2.0, FFT_SHIFT_RANGE * norm2bi(value)));
 }
 
 void fft_pitchshift() {
@@ -126,9 +126,9 @@ void fft_pitchshift() {
 enum { K, A, SN, P, T, SH, CL, NUM_BUF };
 buffer_p buf[NUM_BUF];
 
-sampler_p smp;
+voices_p smp;
 slider_p smp_spd;
-void spd_changed(void *X, float value) { smp->rate = value * 2; }
+void spd_changed(void *X, float value) { ctrl_float(&smp->rate, value * 2); }
 
 slider_p volume_sl;
 
@@ -138,39 +138,56 @@ struct {
   metro_p met;
   slider_p sl;
 } met;
-void met_changed(void *X, float value) { met.met->dur = sec2samp(value * 0.5); }
+void met_changed(void *X, float value) {
+  ctrl_int(&met.met->dur, sec2samp(value * 0.5));
+}
+// restarts the beat on the frame the pad was hit
+void met_restart(void *X, const void *data) { met.met->value = met.met->dur; }
+void met_tap() { ctrl_send(met_restart, NULL, NULL, 0); }
 
 struct {
   comb_p comb;
   slider_p del;
 } comb;
-void comb_del_changed(void *X, float value) { comb.comb->del = value; }
+void comb_del_changed(void *X, float value) {
+  ctrl_float(&comb.comb->del, value);
+}
 
 struct {
   delay_p del;
   slider_p del_sl, mix_sl;
   button_p active;
 } del;
-void del_del_changed(void *X, float value) { del.del->del = value * 2; }
-void del_mix_changed(void *X, float value) { del.del->mix = value; }
+void del_del_changed(void *X, float value) {
+  ctrl_float(&del.del->del, value * 2);
+}
+void del_mix_changed(void *X, float value) {
+  ctrl_float(&del.del->mix, value);
+}
 
 struct {
   filter_p filter;
   slider_p res, freq, type;
+  float f, r;
+  filter_type_t t;
 } filter;
 void filter_freq_changed(void *X, float value) {
-  filter_set(filter.filter, filter.filter->type, value * 10000);
+  filter.f = value * 10000;
+  filter_send(filter.filter, filter.t, filter.f, filter.r);
 }
 void filter_res_changed(void *X, float value) {
-  filter_res(filter.filter, value * 50);
+  filter.r = value * 50;
+  filter_send(filter.filter, filter.t, filter.f, filter.r);
 }
 void filter_type_changed(void *X, float value) {
-  filter_set(filter.filter, floorf(value * 2), filter.filter->freq);
+  filter.t = floorf(value * 2);
+  filter_send(filter.filter, filter.t, filter.f, filter.r);
 }
 
 struct {
   button_p active;
   slider_p bit;
+  over_p over;
 } crush;
 
 struct {
@@ -178,45 +195,48 @@ struct {
   slider_p dur, speed;
   looper_p looper;
 } looper;
-void looper_toggle(bool value) { looper_set(looper.looper, value); }
-void looper_dur(void *X, float value) { looper.looper->dur = value; }
+void looper_record(void *X, const void *data) {
+  looper_set(X, *(const bool *)data);
+}
+void looper_toggle(bool value) {
+  ctrl_send(looper_record, looper.looper, &value, sizeof(value));
+}
+void looper_dur(void *X, float value) {
+  ctrl_float(&looper.looper->dur, value);
+}
 void looper_speed(void *X, float value) {
-  looper.looper->speed = norm2bi(value) * 4;
+  ctrl_float(&looper.looper->speed, norm2bi(value) * 4);
 }
 
 //-------------------------------------
-void audio_callback() {
-  looper.looper->dur = looper.dur->value;
-
-  audio_loop {
-    sample_t s = sample_zero;
+// graph
+//-------------------------------------
+// drums -> fft -> comb -> filter -> master -> out
+//                                \-> delay -/
+graph_p graph;
 
-    if (metro_update(met.met)) {
-      smp->buf = buf[irand(0, NUM_BUF)];
-      sampler_trigger(smp);
-    }
+//-------------------------------------
+void drums_process(void *X, const float *in[2], float *out[2], int frames) {
+  loop(i, frames) {
+    if (metro_update(met.met))
+      voices_play(smp, buf[irand(0, NUM_BUF)], i, 1, 1, 0);
+  }
 
-    if (smp->active)
-      s = sampler_update(smp);
+  PROF("sampler", voices_process(smp, NULL, out, frames));
+}
 
-    //
-    // fft
-    //
-    sample_loop fft.buf[fft.rec * 2 + c] = s.value[c];
+//-------------------------------------
+void fft_process(void *X, const float *in[2], float *out[2], int frames) {
+  loop(i, frames) {
+    sample_loop fft.buf[fft.rec * 2 + c] = in[c][i];
     fft.rec++;
     if (fft.rec >= FFT_BUF_SIZE)
       fft.rec = 0;
 
-    s = make_sample(fft.out[fft.read * 2 + 0], fft.out[fft.read * 2 + 1]);
-    s = comb_update(comb.comb, s);
-    s = filter_update(filter.filter, s);
-    audio_out(s);
-
-    s = delay_update(del.del, s);
-    if (del.active->value)
-      audio_out(s);
-
-    sample_loop fft.out[fft.read * 2 + c] = 0;
+    sample_loop {
+      out[c][i] = fft.out[fft.read * 2 + c];
+      fft.out[fft.read * 2 + c] = 0;
+    }
 
     fft.read++;
     if (fft.read >= FFT_BUF_SIZE)
@@ -225,21 +245,86 @@ void audio_callback() {
     fft.hopcounter++;
     if (fft.hopcounter >= fft.hop_size) {
       fft.hopcounter = 0;
-      fft_pitchshift();
+      PROF("pitchshift", fft_pitchshift());
     }
+  }
+}
+
+//-------------------------------------
+void del_process(void *X, const float *in[2], float *out[2], int frames) {
+  delay_process(del.del, in, out, frames);
+
+  if (!del.active->value)
+    sample_loop memset(out[c], 0, frames * sizeof(float));
+}
 
-    // post
-    s = audio_get();
-    s = sample_mul_s(s, volume_sl->value);
-    if (crush.active->value)
-      s = effect_bit(s, scale_norm(crush.bit->value, 1, 16));
-    s = looper_update(looper.looper, s);
-    audio_set(s);
+//-------------------------------------
+void master_process(void *X, const float *in[2], float *out[2], int frames) {
+  sample_loop block_mul_s(out[c], in[c], volume_sl->value, frames);
+  if (crush.active->value) {
+    crush.over->amt = scale_norm(crush.bit->value, 1, 16);
+    over_process(crush.over, block_in(out), out, frames);
   }
+  PROF("looper", looper_process(looper.looper, block_in(out), out, frames));
+}
+
+//-------------------------------------
+void graph_setup(int threads) {
+  graph = graph_new();
+  graph->pool = pool_new(threads);
+
+  node_p drums = graph_unit(graph, "drums", NULL, drums_process);
+  node_p pitch = graph_unit(graph, "fft", NULL, fft_process);
+  node_p cmb = graph_unit(graph, "comb", comb.comb, comb_process);
+  node_p flt = graph_unit(graph, "filter", filter.filter, filter_process);
+  node_p dly = graph_unit(graph, "delay", NULL, del_process);
+  node_p master = graph_unit(graph, "master", NULL, master_process);
+
+  graph_connect(graph, drums, 0, pitch, 0);
+  graph_connect(graph, pitch, 0, cmb, 0);
+  graph_connect(graph, cmb, 0, flt, 0);
+  graph_connect(graph, flt, 0, master, 0);
+  graph_connect(graph, flt, 0, dly, 0);
+  graph_connect(graph, dly, 0, master, 0);
+  graph_connect(graph, master, 0, graph->output, 0);
+
+  graph_commit(graph);
+}
+
+//-------------------------------------
+void audio_callback() {
+  looper.looper->dur = looper.dur->value;
+  graph_process(graph, audio.frames);
 }
 
 //-------------------------------------
-void gui_callback() { midi_draw(); }
+// p99 and max load in percent of the period, jack's own dsp load and the
+// xrun count, along the bottom row. redrawn twice a second
+void load_draw() {
+  static int frame = 0;
+  if (frame++ % 30)
+    return;
+
+  load_stats_t S = load_stats();
+  char str[32];
+  snprintf(str, 32, "dsp %.0f %.0f jk %.0f xr %lu", S.p99 * 100, S.max * 100,
+           S.cpu, S.xruns);
+
+  color_background();
+  rect_t r = {0.5 * GRID_SIZE, (HEIGHT - 1 - 0.5) * GRID_SIZE,
+              14 * GRID_SIZE, GRID_SIZE};
+  draw_rect(&r);
+
+  color_accent();
+  draw_string(str, 1, HEIGHT - 1);
+  color_background();
+}
+
+//-------------------------------------
+void gui_callback() {
+  midi_draw();
+  load_draw();
+}
 
 //-------------------------------------
 void midi_callback(uint track, uint ctrl, float value) {
@@ -292,13 +377,17 @@ void midi_callback(uint track, uint ctrl, float value) {
       if (value > 0.5 && midi.ctrl[track][ctrl] < 0.5)
         button_set(crush.active, !crush.active->value);
       break;
+    case 33:
+      if (value > 0.5 && midi.ctrl[track][ctrl] < 0.5)
+        met_tap();
+      break;
     case 37:
       if (value > 0.5 && midi.ctrl[track][ctrl] < 0.5)
         button_set(del.active, !del.active->value);
       break;
     case 69:
       if (value > 0.5 && midi.ctrl[track][ctrl] < 0.5) {
-        looper_set(looper.looper, looper.active->value);
+        looper_toggle(looper.active->value);
         button_set(looper.active, !looper.active->value);
       }
       break;
@@ -309,10 +398,70 @@ void midi_callback(uint track, uint ctrl, float value) {
 }
 
 //-------------------------------------
-int main(void) {
-  init();
+void usage() {
+  printf("usage: compakt [-t threads] [-c chans | -c in:out] [-o factor] "
+         "[-l load.log] [-u] [-r out.wav [-i in.wav] [-d secs] [-b frames] "
+         "[-s rate]]\n");
+}
 
-  midi_init(3);
+//-------------------------------------
+int main(int argc, char **argv) {
+  struct {
+    char *in, *out, *log;
+    float dur;
+    int frames, threads, over;
+    double rate;
+    bool resample;
+  } args = {NULL, NULL, NULL, 0, 256, -1, 1, 48000, false};
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:i:d:b:s:t:c:l:o:uh")) != -1) {
+    switch (opt) {
+    case 'r':
+      args.out = optarg;
+      break;
+    case 'i':
+      args.in = optarg;
+      break;
+    case 'd':
+      args.dur = atof(optarg);
+      break;
+    case 'b':
+      args.frames = atoi(optarg);
+      break;
+    case 's':
+      args.rate = atof(optarg);
+      break;
+    case 't':
+      args.threads = atoi(optarg);
+      break;
+    case 'l':
+      args.log = optarg;
+      break;
+    case 'o':
+      args.over = atoi(optarg);
+      break;
+    case 'u':
+      args.resample = true;
+      break;
+    case 'c':
+      if (sscanf(optarg, "%u:%u", &audio_chans_in, &audio_chans_out) == 1)
+        audio_chans_out = audio_chans_in;
+      break;
+    default:
+      usage();
+      return opt != 'h';
+    }
+  }
+
+  if (args.out) {
+    if (audio_init_offline(args.rate, args.frames, audio_chans_in,
+                           audio_chans_out))
+      return -1;
+  } else {
+    init();
+    midi_init(3);
+  }
 
   //-------------------------------------
   // setup
@@ -340,8 +489,10 @@ int main(void) {
     slider_set(volume_sl, 0);
 
     //
-    filter.filter = filter_new(), filter_set(filter.filter, LPF, 1000);
+    filter.filter = filter_new(), filter_mode(filter.filter, FILTER_SVF);
+    filter_set(filter.filter, LPF, 1000);
     filter_res(filter.filter, 1);
+    filter.t = LPF, filter.f = 1000, filter.r = 1;
 
     filter.freq = slider_new(3, 8, 1, 4);
     filter.freq->on_change = filter_freq_changed;
@@ -390,12 +541,14 @@ int main(void) {
 
     //
     {
-      char *files[NUM_BUF] = {
+      const char *files[NUM_BUF] = {
           "samples/k/0.wav",  "samples/a/0.wav", "samples/sn/0.wav",
           "samples/p/0.wav",  "samples/t/0.wav", "samples/sh/0.wav",
           "samples/cl/0.wav",
       };
-      loop(b, NUM_BUF) { buf[b] = buffer_new(), buffer_load(buf[b], files[b]); }
+      // -u converts them to the engine's rate once (cached on disk)
+      loop(b, NUM_BUF) buf[b] = buffer_new();
+      buffer_load_many(buf, files, NUM_BUF, args.resample ? audio.rate : 0);
     }
 
     //
@@ -412,13 +565,14 @@ int main(void) {
     slider_set(crush.bit, 1);
     widget_name(crush.bit, "bit");
 
+    crush.over = over_new(effect_bit_block, args.over);
+
     crush.active = button_new(3, 13, 1, 1);
     crush.active->toggle = true;
     widget_name(crush.active, "csh");
 
     //
-    smp = sampler_new(), smp->buf = buf[K];
-    sampler_trigger(smp);
+    smp = voices_new(128);
 
     smp_spd = slider_new(7, 13, 1, 4);
     smp_spd->on_change = spd_changed;
@@ -445,27 +599,44 @@ int main(void) {
     widget_name(looper.active, "loo");
     looper.active->toggle = true;
     looper.active->on_click = looper_toggle;
+
+    //
+    graph_setup(args.threads);
   }
 
   //-------------------------------------
-  start();
+  if (args.out)
+    audio_render(args.in, args.out, args.dur);
+  else
+    start();
 
   //-------------------------------------
+  load_print();
+  prof_print();
+  if (args.log)
+    load_dump(args.log);
+
   midi_cleanup();
   cleanup();
 
   //-------------------------------------
   // destroy
   {
-    looper_destroy(looper.looper);
-    delay_destroy(del.del), free(del.del);
-    comb_destroy(comb.comb), free(comb.comb);
-    free(filter.filter);
-    free(smp);
-    free(met.met);
-    fft_destroy(fft.fft), free(fft.fft);
-    loop(b, NUM_BUF) buffer_destroy(buf[b]), free(buf[b]);
+    pool_destroy(graph->pool), free(graph->pool);
+    graph_destroy(graph), free(graph);
+    looper_destroy(looper.looper), mem_free(looper.looper);
+    delay_destroy(del.del), mem_free(del.del);
+    comb_destroy(comb.comb), mem_free(comb.comb);
+    mem_free(filter.filter);
+    over_destroy(crush.over), mem_free(crush.over);
+    mem_free(smp);
+    mem_free(met.met);
+    fft_destroy(fft.fft), mem_free(fft.fft);
+    loop(b, NUM_BUF) buffer_destroy(buf[b]), mem_free(buf[b]);
   }
 
+  mem_print();
+  mem_cleanup();
+
   return 0;
 }
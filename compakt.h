@@ -2,6 +2,8 @@
 #define COMPACT
 
 #include "audio.h"
+#include "conv.h"
+#include "graph.h"
 #include "gui.h"
 #include "midi.h"
 #include "utils.h"
@@ -0,0 +1,345 @@
+#ifndef CONV
+#define CONV
+
+#include "audio.h"
+#include "pool.h"
+#include "utils.h"
+
+//-------------------------------------
+// conv
+//-------------------------------------
+// stereo convolution with a long impulse response (a buffer_t, e.g. from
+// buffer_load), partitioned overlap-save. the ir is cut into stages: the
+// first uses blocks of one period and runs on the audio thread, each later
+// one uses blocks 4 times longer and runs on its own background thread, with
+// a whole block of its own length to finish before its output is due. every
+// partition's spectrum is made once in conv_init, and each stage keeps the
+// spectra of its last few input blocks (a frequency-domain delay line), so a
+// block costs one fft each way plus a complex multiply-add per partition.
+// the output is one block (a period) late
+#define CONV_MAX_STAGES 8
+#define CONV_PARTS 8
+#define CONV_GROWTH 4
+#define CONV_MAX_BLOCK 8192
+#define CONV_PRIORITY (POOL_PRIORITY - 5)
+
+typedef struct {
+  fft_t fft;
+  int block, parts, offset, bins, slot;
+
+  // spectra as split re/im floats, parts * bins each: the ir's partitions,
+  // the delay line of input blocks, and their sum
+  float *h[2][2], *x[2][2], *acc[2][2];
+  float *ring[2], *data;
+  int mask;
+
+  // the input history, shared by every stage
+  const float *hist[2];
+  int hist_mask;
+
+  pthread_t thread;
+  sem_t wake, done;
+  bool threaded, busy, quit;
+  uint end;
+} conv_stage_t;
+
+typedef struct {
+  conv_stage_t stage[CONV_MAX_STAGES];
+  int stages, block;
+
+  float *hist[2];
+  int hist_mask;
+  uint count;
+
+  float dry, wet;
+} conv_t;
+typedef conv_t *conv_p;
+int conv_init(conv_t *C, buffer_t *ir, int block);
+conv_t *conv_new(buffer_t *ir, int block);
+void conv_destroy(conv_t *C);
+
+//-------------------------------------
+// acc += x * h, over n complex bins in split form
+void conv_mac(float *acc_re, float *acc_im, const float *x_re,
+              const float *x_im, const float *h_re, const float *h_im, int n) {
+  int i = 0;
+#ifdef VEC_SIZE
+  block_loop(i, n) {
+    vec_t xr = vec_load(x_re + i), xi = vec_load(x_im + i);
+    vec_t hr = vec_load(h_re + i), hi = vec_load(h_im + i);
+    vec_t re = vec_sub(vec_mul(xr, hr), vec_mul(xi, hi));
+    vec_t im = vec_add(vec_mul(xr, hi), vec_mul(xi, hr));
+    vec_store(acc_re + i, vec_add(vec_load(acc_re + i), re));
+    vec_store(acc_im + i, vec_add(vec_load(acc_im + i), im));
+  }
+#endif
+  for (; i < n; ++i) {
+    acc_re[i] += x_re[i] * h_re[i] - x_im[i] * h_im[i];
+    acc_im[i] += x_re[i] * h_im[i] + x_im[i] * h_re[i];
+  }
+}
+
+//-------------------------------------
+// the fft's spectrum into split floats
+void conv_split(fft_t *F, uint c, float *re, float *im) {
+  loop(f, F->size / 2 + 1) re[f] = F->out[c][f][0], im[f] = F->out[c][f][1];
+}
+
+//-------------------------------------
+// one block of the stage, the input ending at frame end. the last half of
+// the inverse fft is the output, due offset frames later
+void conv_stage_run(conv_stage_t *S) {
+  fft_t *F = &S->fft;
+  int N = S->block, bins = S->bins;
+  uint start = S->end - 2 * N;
+
+  sample_loop {
+    loop(i, 2 * N) F->in[c][i] = S->hist[c][(start + i) & S->hist_mask];
+  }
+  fft_r2c(F);
+
+  S->slot = (S->slot + 1) % S->parts;
+  sample_loop {
+    float *re = S->x[c][0] + S->slot * bins, *im = S->x[c][1] + S->slot * bins;
+    conv_split(F, c, re, im);
+
+    float *acc_re = S->acc[c][0], *acc_im = S->acc[c][1];
+    memset(acc_re, 0, bins * sizeof(float));
+    memset(acc_im, 0, bins * sizeof(float));
+
+    loop(p, S->parts) {
+      int slot = (S->slot - p + S->parts) % S->parts;
+      conv_mac(acc_re, acc_im, S->x[c][0] + slot * bins,
+               S->x[c][1] + slot * bins, S->h[c][0] + p * bins,
+               S->h[c][1] + p * bins, bins);
+    }
+
+    loop(f, N + 1) F->out[c][f][0] = acc_re[f], F->out[c][f][1] = acc_im[f];
+  }
+  fft_c2r(F);
+
+  uint out = S->end - N + S->offset;
+  sample_loop {
+    loop(i, N) S->ring[c][(out + i) & S->mask] = F->in[c][N + i] / (2 * N);
+  }
+}
+
+//-------------------------------------
+void *conv_loop(void *X) {
+  conv_stage_t *S = X;
+
+  while (true) {
+    pool_wait(&S->wake);
+    if (__atomic_load_n(&S->quit, __ATOMIC_ACQUIRE))
+      break;
+
+    conv_stage_run(S);
+    sem_post(&S->done);
+  }
+
+  return NULL;
+}
+
+//-------------------------------------
+// realtime if we're allowed, below the pool's workers
+void conv_thread(conv_stage_t *S, int priority) {
+  sem_init(&S->wake, 0, 0);
+  sem_init(&S->done, 0, 0);
+
+  pthread_attr_t attr;
+  struct sched_param param = {.sched_priority = priority};
+  pthread_attr_init(&attr);
+  pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+  pthread_attr_setschedparam(&attr, &param);
+
+  int error = pthread_create(&S->thread, &attr, conv_loop, S);
+  if (error)
+    error = pthread_create(&S->thread, NULL, conv_loop, S);
+  pthread_attr_destroy(&attr);
+
+  S->threaded = !error;
+  if (error)
+    printf("[conv error] unable to start a worker, running it inline\n");
+}
+
+//-------------------------------------
+// the partitions of one stage, from frame start of the ir on. its output
+// is due delay frames after that
+void conv_stage_init(conv_stage_t *S, buffer_t *ir, int block, int start,
+                     int delay, int parts) {
+  ZERO(S, conv_stage_t);
+
+  S->block = block, S->parts = parts, S->offset = start + delay;
+  S->bins = (block + 1 + 7) & ~7;
+  fft_init_size(&S->fft, 2 * block);
+
+  // the output ring spans from the oldest frame still to be played to the
+  // newest one written
+  int ring = 1;
+  while (ring < S->offset + 3 * block)
+    ring <<= 1;
+  S->mask = ring - 1;
+
+  int spectra = parts * S->bins;
+  S->data = mem_calloc(2 * (4 * spectra + 2 * S->bins + ring), sizeof(float));
+
+  float *data = S->data;
+  sample_loop {
+    loop(k, 2) {
+      S->h[c][k] = data, data += spectra;
+      S->x[c][k] = data, data += spectra;
+      S->acc[c][k] = data, data += S->bins;
+    }
+    S->ring[c] = data, data += ring;
+  }
+
+  // each partition zero padded to twice its length, then to a spectrum
+  fft_t *F = &S->fft;
+  loop(p, parts) {
+    sample_loop {
+      uint chan = MIN(c, ir->chans - 1);
+      loop(i, 2 * block) {
+        int frame = start + p * block + i;
+        F->in[c][i] = i < block && frame < (int)ir->len
+                          ? ir->data[frame * ir->chans + chan]
+                          : 0;
+      }
+    }
+    fft_r2c(F);
+    sample_loop conv_split(F, c, S->h[c][0] + p * S->bins,
+                           S->h[c][1] + p * S->bins);
+  }
+}
+
+//-------------------------------------
+// block is the first stage's length, 0 uses the period
+int conv_init(conv_t *C, buffer_t *ir, int block) {
+  ZERO(C, conv_t);
+  C->dry = 1, C->wet = 1;
+
+  if (!ir || !ir->data || !ir->len) {
+    printf("[conv error] no impulse response\n");
+    return -1;
+  }
+
+  C->block = 16;
+  while (C->block < (block > 0 ? block : (int)audio.frames))
+    C->block <<= 1;
+
+  if (ir->rate != audio.rate)
+    printf("[conv] the ir is at %i hz, not %i\n", ir->rate, (int)audio.rate);
+
+  // stage s starts where s - 1 stopped, at least twice its own block in
+  // (one block to fill, one to compute). the last stage takes the rest
+  int offset = 0, N = C->block;
+  while (offset < (int)ir->len && C->stages < CONV_MAX_STAGES) {
+    bool last = N >= CONV_MAX_BLOCK || C->stages == CONV_MAX_STAGES - 1;
+    int parts = last ? (ir->len - offset + N - 1) / N : CONV_PARTS;
+
+    conv_stage_t *S = &C->stage[C->stages];
+    conv_stage_init(S, ir, N, offset, C->block, parts);
+
+    offset += parts * N;
+    C->stages++;
+    N *= CONV_GROWTH;
+  }
+
+  // the history has to outlast the longest block being worked on
+  int hist = 1;
+  while (hist < 4 * C->stage[C->stages - 1].block)
+    hist <<= 1;
+  C->hist_mask = hist - 1;
+  C->hist[0] = mem_calloc(2 * hist, sizeof(float));
+  C->hist[1] = C->hist[0] + hist;
+
+  loop(s, C->stages) {
+    conv_stage_t *S = &C->stage[s];
+    sample_loop S->hist[c] = C->hist[c];
+    S->hist_mask = C->hist_mask;
+    if (s > 0)
+      conv_thread(S, CONV_PRIORITY - s);
+  }
+
+  printf("[conv] %i frames in %i stages, %i frame blocks\n", ir->len,
+         C->stages, C->block);
+  return 0;
+}
+
+//-------------------------------------
+conv_t *conv_new(buffer_t *ir, int block) {
+  conv_t *C = MEM_NEW(conv_t);
+  conv_init(C, ir, block);
+  return C;
+}
+
+//-------------------------------------
+void conv_destroy(conv_t *C) {
+  loop(s, C->stages) {
+    conv_stage_t *S = &C->stage[s];
+    if (S->threaded) {
+      if (S->busy)
+        pool_wait(&S->done);
+      __atomic_store_n(&S->quit, true, __ATOMIC_RELEASE);
+      sem_post(&S->wake);
+      pthread_join(S->thread, NULL);
+      sem_destroy(&S->wake);
+      sem_destroy(&S->done);
+    }
+    fft_destroy(&S->fft);
+    MEM_FREE(S->data);
+  }
+  MEM_FREE(C->hist[0]);
+  C->stages = 0;
+}
+
+//-------------------------------------
+// a stage whose block just filled: the first runs here, the others are
+// handed to their thread once its last block is done
+void conv_kick(conv_stage_t *S, uint end) {
+  if (!S->threaded) {
+    S->end = end;
+    conv_stage_run(S);
+    return;
+  }
+
+  if (S->busy)
+    pool_wait(&S->done);
+  S->end = end;
+  S->busy = true;
+  sem_post(&S->wake);
+}
+
+//-------------------------------------
+void conv_process(conv_t *C, const float *in[2], float *out[2], int frames) {
+  if (!C->stages)
+    return;
+
+  for (int i = 0; i < frames;) {
+    // up to the next block boundary
+    int n = MIN(frames - i, C->block - (int)(C->count % C->block));
+
+    sample_loop {
+      loop(k, n) {
+        uint t = C->count + k;
+        float wet = 0;
+        loop(s, C->stages) {
+          conv_stage_t *S = &C->stage[s];
+          wet += S->ring[c][t & S->mask];
+        }
+        C->hist[c][t & C->hist_mask] = in[c][i + k];
+        out[c][i + k] = in[c][i + k] * C->dry + wet * C->wet;
+      }
+    }
+
+    C->count += n, i += n;
+
+    loop(s, C->stages) {
+      conv_stage_t *S = &C->stage[s];
+      if (C->count % S->block == 0)
+        conv_kick(S, C->count);
+    }
+  }
+}
+
+#endif
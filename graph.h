@@ -0,0 +1,474 @@
+#ifndef GRAPH
+#define GRAPH
+
+#include "audio.h"
+#include "pool.h"
+#include "utils.h"
+
+//-------------------------------------
+// graph
+//-------------------------------------
+// nodes are connected through typed ports. graph_commit sorts the nodes
+// topologically into a plan with its own preallocated buffers, and hands it
+// to the audio thread, which swaps it in at the start of the next cycle. so
+// the graph can be re-patched while jack is running. with a pool set, the
+// steps of each level are spread over its workers, so nodes on the same level
+// must not share state. a plan keeps its own copy of every node, so a removed
+// node's X may be freed once the graph_commit after graph_remove returns
+#define GRAPH_MAX_NODES 64
+#define GRAPH_MAX_EDGES 256
+#define GRAPH_MAX_PORTS 4
+#define GRAPH_MAX_FRAMES 2048
+
+typedef enum { PORT_AUDIO, PORT_CONTROL } port_type_t;
+
+// audio ports are planar stereo, control ports are a single channel
+#define port_chans(t) ((t) == PORT_AUDIO ? 2 : 1)
+
+typedef void (*unit_process_t)(void *X, const float *in[2], float *out[2],
+                               int frames);
+
+typedef struct {
+  char *name;
+  void *X;
+  unit_process_t process;
+  int num_in, num_out;
+  port_type_t in[GRAPH_MAX_PORTS], out[GRAPH_MAX_PORTS];
+  int bus, prof;
+  bool used, removed;
+} node_t;
+typedef node_t *node_p;
+
+typedef struct {
+  node_t *src, *dst;
+  int out, in;
+} edge_t;
+
+// one node call in the plan. in/out are indexed [port * 2 + chan]. node is a
+// copy, so the plan never reads G->nodes, id is only used while compiling
+typedef struct {
+  node_t node;
+  const node_t *id;
+  int level, mix_start, mix_end;
+  const float *in[GRAPH_MAX_PORTS * 2];
+  float *out[GRAPH_MAX_PORTS * 2];
+} step_t;
+
+// summing of several edges into one input port, run before the step
+typedef struct {
+  float *dst;
+  const float *src;
+  bool copy;
+} mix_t;
+
+// steps with the same level don't depend on each other and can run in
+// parallel. levels are contiguous: level l is steps[level_start[l]] up to
+// steps[level_start[l + 1]]
+typedef struct {
+  step_t steps[GRAPH_MAX_NODES];
+  int num_steps, num_levels;
+  int level_start[GRAPH_MAX_NODES + 1];
+  mix_t *mix;
+  int num_mix;
+  float *data;
+} plan_t;
+
+typedef struct {
+  node_t nodes[GRAPH_MAX_NODES];
+  edge_t edges[GRAPH_MAX_EDGES];
+  int num_edges;
+  node_t *input, *output;
+  plan_t *plan, *in_use;
+  pool_t *pool;
+  struct {
+    plan_t *plan;
+    int start, offset, frames;
+  } level;
+  float zero[GRAPH_MAX_FRAMES];
+} graph_t;
+typedef graph_t *graph_p;
+
+void graph_init(graph_t *G);
+graph_t *graph_new();
+void graph_destroy(graph_t *G);
+node_t *graph_node(graph_t *G, char *name, void *X, unit_process_t process,
+                   int num_in, const port_type_t *in, int num_out,
+                   const port_type_t *out);
+node_t *graph_unit_(graph_t *G, char *name, void *X, unit_process_t process);
+node_t *graph_bus_in(graph_t *G, char *name, int chan);
+node_t *graph_bus_out(graph_t *G, char *name, int chan);
+node_t *graph_vocoder(graph_t *G, char *name, vocoder_t *V);
+void graph_remove(graph_t *G, node_t *N);
+int graph_connect(graph_t *G, node_t *src, int out, node_t *dst, int in);
+void graph_disconnect(graph_t *G, node_t *src, int out, node_t *dst, int in);
+int graph_commit(graph_t *G);
+void graph_process(graph_t *G, int frames);
+
+// nodes are called like the *_process functions in audio.h, with in/out
+// indexed [port * 2 + chan]. any of those makes a node with one audio port in
+// and one out
+#define graph_unit(G, name, X, process)                                       \
+  graph_unit_(G, name, X, (unit_process_t)(process))
+
+//-------------------------------------
+// io nodes are handled by the graph itself, reading from or adding to the
+// pair of audio channels starting at their bus. outputs are only summed in
+// once every level has run, on the calling thread, since two of them can
+// share a channel
+void graph_in_process(void *X, const float *in[2], float *out[2],
+                      int frames) {}
+void graph_out_process(void *X, const float *in[2], float *out[2],
+                       int frames) {}
+
+//-------------------------------------
+void graph_init(graph_t *G) {
+  ZERO(G, graph_t);
+
+  G->input = graph_bus_in(G, "in", 0);
+  G->output = graph_bus_out(G, "out", 0);
+}
+
+//-------------------------------------
+graph_t *graph_new() {
+  graph_t *G = NEW(graph_t);
+  graph_init(G);
+  return G;
+}
+
+//-------------------------------------
+void plan_destroy(plan_t *P) {
+  if (!P)
+    return;
+
+  FREE(P->mix);
+  FREE(P->data);
+  free(P);
+}
+
+//-------------------------------------
+void graph_destroy(graph_t *G) {
+  plan_destroy(G->plan);
+  G->plan = NULL;
+}
+
+//-------------------------------------
+node_t *graph_node(graph_t *G, char *name, void *X, unit_process_t process,
+                   int num_in, const port_type_t *in, int num_out,
+                   const port_type_t *out) {
+  if (num_in > GRAPH_MAX_PORTS || num_out > GRAPH_MAX_PORTS) {
+    printf("[graph error] %s has too many ports\n", name);
+    return NULL;
+  }
+
+  loop(i, GRAPH_MAX_NODES) {
+    node_t *N = &G->nodes[i];
+    if (N->used)
+      continue;
+
+    ZERO(N, node_t);
+    N->name = name, N->X = X, N->process = process;
+    N->num_in = num_in, N->num_out = num_out;
+    loop(p, num_in) N->in[p] = in[p];
+    loop(p, num_out) N->out[p] = out[p];
+    N->used = true;
+#ifdef PROFILE
+    N->prof = prof_unit(name);
+#endif
+    return N;
+  }
+
+  printf("[graph error] no more nodes available for %s\n", name);
+  return NULL;
+}
+
+//-------------------------------------
+node_t *graph_unit_(graph_t *G, char *name, void *X, unit_process_t process) {
+  port_type_t audio_port[1] = {PORT_AUDIO};
+  return graph_node(G, name, X, process, 1, audio_port, 1, audio_port);
+}
+
+//-------------------------------------
+node_t *graph_bus_in(graph_t *G, char *name, int chan) {
+  port_type_t audio_port[1] = {PORT_AUDIO};
+  node_t *N =
+      graph_node(G, name, NULL, graph_in_process, 0, NULL, 1, audio_port);
+  if (N)
+    N->bus = chan;
+  return N;
+}
+
+//-------------------------------------
+node_t *graph_bus_out(graph_t *G, char *name, int chan) {
+  port_type_t audio_port[1] = {PORT_AUDIO};
+  node_t *N =
+      graph_node(G, name, NULL, graph_out_process, 1, audio_port, 0, NULL);
+  if (N)
+    N->bus = chan;
+  return N;
+}
+
+//-------------------------------------
+// input 0 is the carrier, input 1 the modulator
+node_t *graph_vocoder(graph_t *G, char *name, vocoder_t *V) {
+  port_type_t audio_port[2] = {PORT_AUDIO, PORT_AUDIO};
+  return graph_node(G, name, V, (unit_process_t)vocoder_process, 2,
+                    audio_port, 1, audio_port);
+}
+
+//-------------------------------------
+void graph_remove(graph_t *G, node_t *N) {
+  if (!N || N == G->input || N == G->output)
+    return;
+
+  for (int e = G->num_edges - 1; e >= 0; --e)
+    if (G->edges[e].src == N || G->edges[e].dst == N)
+      G->edges[e] = G->edges[--G->num_edges];
+
+  // the slot is released by graph_commit, once the old plan is done with it
+  N->removed = true;
+}
+
+//-------------------------------------
+int graph_connect(graph_t *G, node_t *src, int out, node_t *dst, int in) {
+  if (!src || !dst || src->removed || dst->removed || out >= src->num_out ||
+      in >= dst->num_in) {
+    printf("[graph error] no such port\n");
+    return -1;
+  }
+
+  if (src->out[out] != dst->in[in]) {
+    printf("[graph error] port types differ, %s:%i -> %s:%i\n", src->name, out,
+           dst->name, in);
+    return -1;
+  }
+
+  if (G->num_edges >= GRAPH_MAX_EDGES) {
+    printf("[graph error] no more edges available\n");
+    return -1;
+  }
+
+  G->edges[G->num_edges++] = (edge_t){src, dst, out, in};
+  return 0;
+}
+
+//-------------------------------------
+void graph_disconnect(graph_t *G, node_t *src, int out, node_t *dst, int in) {
+  for (int e = G->num_edges - 1; e >= 0; --e) {
+    edge_t *E = &G->edges[e];
+    if (E->src == src && E->out == out && E->dst == dst && E->in == in)
+      *E = G->edges[--G->num_edges];
+  }
+}
+
+//-------------------------------------
+// kahn's algorithm, level by level. returns NULL if there is a cycle
+plan_t *graph_compile(graph_t *G) {
+  plan_t *P = NEW(plan_t);
+  int level[GRAPH_MAX_NODES], deps[GRAPH_MAX_NODES], order[GRAPH_MAX_NODES];
+  int num_nodes = 0, num_bufs = 0, num_mix = 0;
+
+  loop(n, GRAPH_MAX_NODES) {
+    level[n] = -1, deps[n] = 0;
+    if (G->nodes[n].used && !G->nodes[n].removed)
+      num_nodes++;
+  }
+
+  loop(e, G->num_edges) deps[G->edges[e].dst - G->nodes]++;
+
+  // each pass takes every node whose inputs are all done
+  int done = 0;
+  for (int l = 0; done < num_nodes; ++l) {
+    int start = done;
+    loop(n, GRAPH_MAX_NODES) {
+      node_t *N = &G->nodes[n];
+      if (N->used && !N->removed && level[n] < 0 && deps[n] == 0)
+        level[n] = l, order[done++] = n;
+    }
+
+    if (done == start) {
+      printf("[graph error] the graph has a cycle\n");
+      free(P);
+      return NULL;
+    }
+
+    for (int i = start; i < done; ++i)
+      loop(e, G->num_edges) {
+        if (G->edges[e].src - G->nodes == order[i])
+          deps[G->edges[e].dst - G->nodes]--;
+      }
+
+    P->level_start[l] = start;
+    P->level_start[l + 1] = done;
+    P->num_levels = l + 1;
+  }
+
+  // count buffers: one per output port, plus one per summed input port
+  loop(i, num_nodes) {
+    node_t *N = &G->nodes[order[i]];
+    loop(p, N->num_out) num_bufs += port_chans(N->out[p]);
+    loop(p, N->num_in) {
+      int edges = 0;
+      loop(e, G->num_edges) {
+        edges += G->edges[e].dst == N && G->edges[e].in == p;
+      }
+      if (edges > 1) {
+        num_bufs += port_chans(N->in[p]);
+        num_mix += edges * port_chans(N->in[p]);
+      }
+    }
+  }
+
+  P->data = calloc(MAX(num_bufs, 1) * GRAPH_MAX_FRAMES, sizeof(float));
+  P->mix = calloc(MAX(num_mix, 1), sizeof(mix_t));
+  float *buf = P->data;
+
+  // outputs first, so every input can point at its source
+  P->num_steps = num_nodes;
+  loop(i, num_nodes) {
+    step_t *S = &P->steps[i];
+    S->node = G->nodes[order[i]];
+    S->id = &G->nodes[order[i]];
+    S->level = level[order[i]];
+
+    loop(p, S->node.num_out) loop(c, port_chans(S->node.out[p])) {
+      S->out[p * 2 + c] = buf;
+      buf += GRAPH_MAX_FRAMES;
+    }
+  }
+
+  loop(i, num_nodes) {
+    step_t *S = &P->steps[i];
+    const node_t *N = S->id;
+    S->mix_start = P->num_mix;
+
+    loop(p, N->num_in) {
+      int chans = port_chans(N->in[p]), edges = 0;
+      loop(c, chans) S->in[p * 2 + c] = G->zero;
+
+      loop(e, G->num_edges) {
+        edge_t *E = &G->edges[e];
+        if (E->dst != N || E->in != p)
+          continue;
+
+        step_t *from = NULL;
+        loop(j, num_nodes) if (P->steps[j].id == E->src) from = &P->steps[j];
+
+        if (edges == 0) {
+          loop(c, chans) S->in[p * 2 + c] = from->out[E->out * 2 + c];
+        } else {
+          // more than one edge: sum into a buffer of our own
+          if (edges == 1) {
+            loop(c, chans) {
+              P->mix[P->num_mix++] = (mix_t){buf, S->in[p * 2 + c], true};
+              S->in[p * 2 + c] = buf;
+              buf += GRAPH_MAX_FRAMES;
+            }
+          }
+          loop(c, chans) P->mix[P->num_mix++] =
+              (mix_t){(float *)S->in[p * 2 + c], from->out[E->out * 2 + c],
+                      false};
+        }
+        edges++;
+      }
+    }
+
+    S->mix_end = P->num_mix;
+  }
+
+  return P;
+}
+
+//-------------------------------------
+int graph_commit(graph_t *G) {
+  plan_t *P = graph_compile(G);
+  if (!P)
+    return -1;
+
+  plan_t *old = __atomic_exchange_n(&G->plan, P, __ATOMIC_SEQ_CST);
+
+  // wait for the audio thread to let go of the old plan before freeing it
+  while (old && __atomic_load_n(&G->in_use, __ATOMIC_SEQ_CST) == old)
+    usleep(100);
+  plan_destroy(old);
+
+  // no plan refers to removed nodes anymore, so their slots can be reused
+  loop(n, GRAPH_MAX_NODES) {
+    node_t *N = &G->nodes[n];
+    if (N->removed)
+      N->used = false, N->removed = false;
+  }
+
+  return 0;
+}
+
+//-------------------------------------
+void graph_step(graph_t *G, plan_t *P, step_t *S, int offset, int frames) {
+  node_t *N = &S->node;
+
+  for (int m = S->mix_start; m < S->mix_end; ++m) {
+    mix_t *M = &P->mix[m];
+    if (M->copy)
+      memcpy(M->dst, M->src, frames * sizeof(float));
+    else
+      block_add(M->dst, M->dst, M->src, frames);
+  }
+
+  if (N->process == graph_in_process) {
+    sample_loop {
+      const float *buf = audio.buf_in[MIN(N->bus + c, audio.chans_in - 1)];
+      memcpy(S->out[c], buf + offset, frames * sizeof(float));
+    }
+  } else if (N->process != graph_out_process) {
+    PROF_AT(N->prof, N->process(N->X, S->in, S->out, frames));
+  }
+}
+
+//-------------------------------------
+void graph_out(plan_t *P, int offset, int frames) {
+  loop(i, P->num_steps) {
+    step_t *S = &P->steps[i];
+    node_t *N = &S->node;
+    if (N->process != graph_out_process)
+      continue;
+
+    sample_loop {
+      float *buf = audio.buf_out[MIN(N->bus + c, audio.chans_out - 1)];
+      block_add(buf + offset, buf + offset, S->in[c], frames);
+    }
+  }
+}
+
+//-------------------------------------
+void graph_job(void *X, int i) {
+  graph_t *G = X;
+  plan_t *P = G->level.plan;
+  graph_step(G, P, &P->steps[G->level.start + i], G->level.offset,
+             G->level.frames);
+}
+
+//-------------------------------------
+// runs the current plan over audio.buf_in/buf_out, called from audio_callback
+void graph_process(graph_t *G, int frames) {
+  plan_t *P;
+  do {
+    P = __atomic_load_n(&G->plan, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&G->in_use, P, __ATOMIC_SEQ_CST);
+  } while (P != __atomic_load_n(&G->plan, __ATOMIC_SEQ_CST));
+
+  if (P) {
+    for (int offset = 0; offset < frames; offset += GRAPH_MAX_FRAMES) {
+      int n = MIN(frames - offset, GRAPH_MAX_FRAMES);
+      loop(l, P->num_levels) {
+        int start = P->level_start[l], num = P->level_start[l + 1] - start;
+        G->level.plan = P, G->level.start = start;
+        G->level.offset = offset, G->level.frames = n;
+        pool_run(G->pool, graph_job, G, num);
+      }
+      graph_out(P, offset, n);
+    }
+  }
+
+  __atomic_store_n(&G->in_use, NULL, __ATOMIC_SEQ_CST);
+}
+
+#endif
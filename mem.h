@@ -0,0 +1,189 @@
+#ifndef MEM
+#define MEM
+
+#include "utils.h"
+
+#include <sys/mman.h>
+
+//-------------------------------------
+// mem
+//-------------------------------------
+// a preallocated, mlock'ed arena for audio objects, so units can be created
+// while the engine is running without page faults or the system allocator.
+// blocks are rounded up to a power of two; freed blocks go on a free list
+// for their size and are reused before the arena grows any further. pointers
+// from outside the arena (or from the calloc fallback, when the arena is full
+// or was never set up) can still be passed to mem_free
+#ifndef MEM_SIZE
+#define MEM_SIZE (64 << 20)
+#endif
+
+#define MEM_NUM_CLASSES 32
+
+typedef struct mem_block_t {
+  struct mem_block_t *next;
+  uint size_class, magic;
+} mem_block_t;
+
+#define MEM_MAGIC 0x6d656d21
+
+typedef struct {
+  size_t size, used, peak;
+  int live, fallback;
+  bool locked;
+} mem_stats_t;
+
+struct {
+  char *data;
+  size_t top;
+  mem_block_t *free[MEM_NUM_CLASSES];
+  mem_stats_t stats;
+  int lock;
+} mem;
+
+int mem_init(size_t size);
+void mem_cleanup();
+void *mem_alloc(size_t size);
+void *mem_calloc(size_t num, size_t size);
+void mem_free(void *X);
+mem_stats_t mem_stats();
+
+#define MEM_NEW(t) mem_calloc(1, sizeof(t))
+#define MEM_FREE(x)                                                            \
+  if (x) {                                                                     \
+    mem_free(x);                                                               \
+    x = NULL;                                                                  \
+  }
+
+//-------------------------------------
+int mem_init(size_t size) {
+  if (mem.data)
+    return 0;
+
+  memset(&mem, 0, sizeof(mem));
+
+  mem.data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem.data == MAP_FAILED) {
+    printf("[mem error] unable to map %zu bytes\n", size);
+    mem.data = NULL;
+    return -1;
+  }
+
+  mem.stats.size = size;
+  mem.stats.locked = mlock(mem.data, size) == 0;
+  if (!mem.stats.locked) {
+    printf("[mem] unable to lock the arena, touching it instead\n");
+    memset(mem.data, 0, size);
+  }
+
+  return 0;
+}
+
+//-------------------------------------
+void mem_cleanup() {
+  if (!mem.data)
+    return;
+
+  if (mem.stats.locked)
+    munlock(mem.data, mem.stats.size);
+  munmap(mem.data, mem.stats.size);
+  memset(&mem, 0, sizeof(mem));
+}
+
+//-------------------------------------
+bool mem_owns(void *X) {
+  return mem.data && (char *)X >= mem.data &&
+         (char *)X < mem.data + mem.stats.size;
+}
+
+//-------------------------------------
+void mem_lock() {
+  while (__atomic_test_and_set(&mem.lock, __ATOMIC_ACQUIRE))
+    ;
+}
+void mem_unlock() { __atomic_clear(&mem.lock, __ATOMIC_RELEASE); }
+
+//-------------------------------------
+void *mem_alloc(size_t size) {
+  uint size_class = 0;
+  while (((size_t)1 << size_class) < size + sizeof(mem_block_t))
+    size_class++;
+
+  size_t block_size = (size_t)1 << size_class;
+  mem_block_t *B = NULL;
+
+  mem_lock();
+  if (mem.data && size_class < MEM_NUM_CLASSES) {
+    if (mem.free[size_class]) {
+      B = mem.free[size_class];
+      mem.free[size_class] = B->next;
+    } else if (mem.top + block_size <= mem.stats.size) {
+      B = (mem_block_t *)(mem.data + mem.top);
+      mem.top += block_size;
+    }
+  }
+
+  if (B) {
+    B->size_class = size_class, B->magic = MEM_MAGIC;
+    mem.stats.used += block_size, mem.stats.live++;
+    mem.stats.peak = MAX(mem.stats.peak, mem.stats.used);
+  } else
+    mem.stats.fallback++;
+  mem_unlock();
+
+  if (!B)
+    return malloc(size);
+
+  return B + 1;
+}
+
+//-------------------------------------
+void *mem_calloc(size_t num, size_t size) {
+  void *X = mem_alloc(num * size);
+  if (X)
+    memset(X, 0, num * size);
+  return X;
+}
+
+//-------------------------------------
+void mem_free(void *X) {
+  if (!X)
+    return;
+
+  if (!mem_owns(X)) {
+    free(X);
+    return;
+  }
+
+  mem_block_t *B = (mem_block_t *)X - 1;
+  if (B->magic != MEM_MAGIC) {
+    printf("[mem error] bad free of %p\n", X);
+    return;
+  }
+
+  mem_lock();
+  B->magic = 0;
+  B->next = mem.free[B->size_class];
+  mem.free[B->size_class] = B;
+  mem.stats.used -= (size_t)1 << B->size_class, mem.stats.live--;
+  mem_unlock();
+}
+
+//-------------------------------------
+mem_stats_t mem_stats() {
+  mem_lock();
+  mem_stats_t S = mem.stats;
+  mem_unlock();
+  return S;
+}
+
+//-------------------------------------
+void mem_print() {
+  mem_stats_t S = mem_stats();
+  printf("[mem] %zu / %zu kb used, %zu kb peak, %i live, %i fallbacks%s\n",
+         S.used >> 10, S.size >> 10, S.peak >> 10, S.live, S.fallback,
+         S.locked ? "" : ", not locked");
+}
+
+#endif
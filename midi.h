@@ -31,6 +31,8 @@ extern void midi_callback(uint track, uint ctrl, float value);
 void *midi_loop() {
   PmEvent buffer[MIDI_BUFFER_SIZE];
 
+  ctrl_set_source(CTRL_MIDI);
+
   while (!midi.quit) {
     while (Pm_Poll(midi.in)) {
       int n = Pm_Read(midi.in, buffer, MIDI_BUFFER_SIZE);
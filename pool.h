@@ -0,0 +1,159 @@
+#ifndef POOL
+#define POOL
+
+#include "audio.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+//-------------------------------------
+// pool
+//-------------------------------------
+// worker threads for the audio thread. pool_run hands out jobs 0..num-1 to
+// the workers and the calling thread, and returns once they are all done, so
+// it can be called from inside audio_callback. workers sleep on a semaphore
+// between cycles and never allocate. with no threads (or serial set) the jobs
+// simply run in order on the calling thread
+#define POOL_MAX_THREADS 16
+#define POOL_PRIORITY 70
+
+typedef void (*job_t)(void *X, int i);
+
+typedef struct {
+  pthread_t threads[POOL_MAX_THREADS];
+  sem_t wake, done;
+  int num_threads;
+  bool serial, realtime, quit;
+
+  // the current batch, only touched by pool_run while no worker is awake
+  job_t job;
+  void *X;
+  int num_jobs, next, awake;
+} pool_t;
+typedef pool_t *pool_p;
+
+int pool_init(pool_t *P, int num_threads);
+pool_t *pool_new(int num_threads);
+void pool_destroy(pool_t *P);
+void pool_run(pool_t *P, job_t job, void *X, int num);
+
+//-------------------------------------
+void pool_wait(sem_t *S) {
+  while (sem_wait(S) && errno == EINTR)
+    ;
+}
+
+//-------------------------------------
+void pool_work(pool_t *P) {
+  int i;
+  while ((i = __atomic_fetch_add(&P->next, 1, __ATOMIC_ACQ_REL)) <
+         P->num_jobs)
+    P->job(P->X, i);
+}
+
+//-------------------------------------
+void *pool_loop(void *X) {
+  pool_t *P = X;
+
+  while (true) {
+    pool_wait(&P->wake);
+    if (__atomic_load_n(&P->quit, __ATOMIC_ACQUIRE))
+      break;
+
+    pool_work(P);
+
+    if (__atomic_sub_fetch(&P->awake, 1, __ATOMIC_ACQ_REL) == 0)
+      sem_post(&P->done);
+  }
+
+  return NULL;
+}
+
+//-------------------------------------
+// num_threads < 0 uses one worker per core, besides the audio thread
+int pool_init(pool_t *P, int num_threads) {
+  ZERO(P, pool_t);
+
+  if (num_threads < 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  num_threads = CLIP(num_threads, 0, POOL_MAX_THREADS);
+
+  sem_init(&P->wake, 0, 0);
+  sem_init(&P->done, 0, 0);
+
+  int priority = POOL_PRIORITY;
+  if (audio.client && jack_client_real_time_priority(audio.client) > 0)
+    priority = jack_client_real_time_priority(audio.client);
+
+  P->realtime = true;
+  loop(t, num_threads) {
+    pthread_attr_t attr;
+    struct sched_param param = {.sched_priority = priority};
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+
+    int error = pthread_create(&P->threads[t], &attr, pool_loop, P);
+    if (error) {
+      // no realtime permissions, fall back to a normal thread
+      P->realtime = false;
+      error = pthread_create(&P->threads[t], NULL, pool_loop, P);
+    }
+    pthread_attr_destroy(&attr);
+
+    if (error) {
+      printf("[pool error] unable to start worker %i\n", t);
+      break;
+    }
+    P->num_threads++;
+  }
+
+  printf("[pool] %i workers%s\n", P->num_threads,
+         P->num_threads && !P->realtime ? ", not realtime" : "");
+  return 0;
+}
+
+//-------------------------------------
+pool_t *pool_new(int num_threads) {
+  pool_t *P = NEW(pool_t);
+  pool_init(P, num_threads);
+  return P;
+}
+
+//-------------------------------------
+void pool_destroy(pool_t *P) {
+  __atomic_store_n(&P->quit, true, __ATOMIC_RELEASE);
+  loop(t, P->num_threads) sem_post(&P->wake);
+  loop(t, P->num_threads) pthread_join(P->threads[t], NULL);
+
+  sem_destroy(&P->wake);
+  sem_destroy(&P->done);
+  P->num_threads = 0;
+}
+
+//-------------------------------------
+void pool_run(pool_t *P, job_t job, void *X, int num) {
+  int wake = P && !P->serial ? MIN(P->num_threads, num - 1) : 0;
+
+  if (wake <= 0) {
+    loop(i, num) job(X, i);
+    return;
+  }
+
+  P->job = job, P->X = X, P->num_jobs = num;
+  __atomic_store_n(&P->next, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&P->awake, wake, __ATOMIC_RELEASE);
+  loop(t, wake) sem_post(&P->wake);
+
+  pool_work(P);
+
+  // every woken worker checks in, even if there was nothing left for it
+  pool_wait(&P->done);
+}
+
+#endif
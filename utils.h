@@ -75,6 +75,12 @@ bool contains(float x1, float y1, float w, float h, float x2, float y2) {
 
 void delay(int ms) { usleep(ms); }
 
+double time_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
 //-------------------------------------
 typedef struct {
   float radius, angle;